@@ -24,8 +24,10 @@
 // Compiler configuration
 #ifdef _WIN32
 #define CC "gcc.exe"  // Windows uses gcc.exe
+#define CXX "g++.exe"
 #else
 #define CC "gcc"      // Unix-like systems use gcc
+#define CXX "g++"
 #endif
 
 // Directory paths
@@ -33,8 +35,15 @@
 #define TEST_SRC_DIR "test/src/"     // Where test source files are
 #define EXAMPLE_DIR "example/"       // Where example programs are
 
-// Compiler flags
+// Compiler flags (-pthread on Unix for the parallel writer pool)
+#ifdef _WIN32
 #define CFLAGS "-std=c99", "-Wall", "-Wextra", "-I.", "-D_POSIX_C_SOURCE=200809L"
+#else
+#define CFLAGS "-std=c99", "-Wall", "-Wextra", "-I.", "-D_POSIX_C_SOURCE=200809L", "-pthread"
+#endif
+
+// The header must also compile as C++; the unused static API is expected there
+#define CXXFLAGS "-std=c++11", "-Wall", "-Wextra", "-Wno-unused-function", "-I.", "-D_POSIX_C_SOURCE=200809L"
 
 /**
  * Check if miniz is embedded in stb_unpack.h
@@ -170,6 +179,37 @@ static int compile_example_exe(const char *exe_name, const char *src_file)
     return ok;
 }
 
+/**
+ * Compile the implementation as C++
+ *
+ * Builds an object file only, so nothing is linked or run; a C construct
+ * that C++ rejects fails the build.
+ *
+ * @param src_file Path to the C++ source file
+ * @return 1 on success, 0 on failure
+ */
+static int compile_cxx_check(const char *src_file)
+{
+    const char *out_path = BUILD_DIR "test_cxx.o";
+    const char *deps[] = { src_file, "stb_unpack.h" };
+    if (!nob_needs_rebuild(out_path, deps, NOB_ARRAY_LEN(deps)))
+    {
+        nob_log(NOB_INFO, "%s up to date", out_path);
+        return 1;
+    }
+
+    nob_log(NOB_INFO, "Checking stb_unpack.h as C++...");
+
+    Nob_Cmd cmd = { 0 };
+    nob_cmd_append(&cmd, CXX);
+    nob_cmd_append(&cmd, CXXFLAGS);
+    nob_cmd_append(&cmd, "-c", "-o", out_path);
+    nob_cmd_append(&cmd, src_file);
+    int ok = nob_cmd_run(&cmd);
+    nob_cmd_free(cmd);
+    return ok;
+}
+
 int main(int argc, char **argv)
 {
     // Auto-rebuild nob if nob.c or nob.h changed
@@ -275,6 +315,10 @@ int main(int argc, char **argv)
         return 1;
     if (!compile_test_exe("test_security", TEST_SRC_DIR "test_security.c"))
         return 1;
+    if (!compile_test_exe("test_features", TEST_SRC_DIR "test_features.c"))
+        return 1;
+    if (!compile_cxx_check(TEST_SRC_DIR "test_cxx.cpp"))
+        return 1;
 
     // Build example program (if requested or if no args provided)
     if (do_example || argc == 0)
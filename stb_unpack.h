@@ -27,6 +27,84 @@
 #endif
 #define STBUP_MAX_PATH_COMPONENTS (STBUP_PATH_MAX / 2)
 
+/* Size of the compressed-input chunks read by the streaming .tar.gz extractor */
+#ifndef STBUP_STREAM_CHUNK
+#define STBUP_STREAM_CHUNK (64 * 1024)
+#endif
+
+/* Define STBUP_NO_THREADS to build without the parallel writer pool */
+#ifdef STBUP_NO_THREADS
+#define STBUP_THREADS 0
+#else
+#define STBUP_THREADS 1
+#endif
+
+/* Number of file-write jobs the writer pool queues ahead of its workers */
+#ifndef STBUP_POOL_QUEUE
+#define STBUP_POOL_QUEUE 64
+#endif
+
+/* Directory entries the scan workers of the archive creators may list ahead of the writer */
+#ifndef STBUP_SCAN_AHEAD
+#define STBUP_SCAN_AHEAD 65536
+#endif
+
+/* Largest entry copied into a pool job when its data cannot be referenced in place */
+#ifndef STBUP_POOL_COPY_MAX
+#define STBUP_POOL_COPY_MAX (64 * 1024)
+#endif
+
+/* Batch file writes through io_uring when asked to and the kernel allows it (Linux) */
+#ifndef STBUP_USE_IO_URING
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define STBUP_USE_IO_URING 1
+#endif
+#endif
+#ifndef STBUP_USE_IO_URING
+#define STBUP_USE_IO_URING 0
+#endif
+#endif
+
+/* Vector kernels for TAR block scans; define STBUP_NO_SIMD for the portable code */
+#ifndef STBUP_NO_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define STBUP_SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define STBUP_SIMD_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define STBUP_SIMD_NEON 1
+#endif
+#endif
+
+/* Files at least this large get their space reserved before they are written */
+#ifndef STBUP_PREALLOC_MIN
+#define STBUP_PREALLOC_MIN (1024 * 1024)
+#endif
+
+/* Granularity of the holes left by the sparse writer: zero runs shorter than this are written */
+#ifndef STBUP_SPARSE_BLOCK
+#define STBUP_SPARSE_BLOCK 4096
+#endif
+
+/* Threads flushing files in durable mode unless num_threads asks for more */
+#ifndef STBUP_SYNC_THREADS
+#define STBUP_SYNC_THREADS 8
+#endif
+
+/* Archive bytes between two checkpoints unless checkpoint_interval says otherwise */
+#ifndef STBUP_CHECKPOINT_INTERVAL
+#define STBUP_CHECKPOINT_INTERVAL (64 * 1024 * 1024)
+#endif
+
+/* Number of output subdirectories kept open during extraction */
+#ifndef STBUP_DIRFD_CACHE
+#define STBUP_DIRFD_CACHE 8
+#endif
+
 /* ============================================================
    Platform filesystem layer
    ============================================================ */
@@ -46,8 +124,10 @@ static int stbup_mkdir(const char *path)
 #else
 #include <sys/stat.h>
 #include <unistd.h>
+#include <errno.h>
 #include <pwd.h>
 #include <grp.h>
+#include <dirent.h>
 
 static int stbup_mkdir(const char *path)
 {
@@ -64,13 +144,138 @@ static int stbup_mkdir(const char *path)
 #include <stdio.h>
 #include <string.h>
 
+#include <time.h>
+
 #ifdef _WIN32
 #include <io.h>
+#include <sys/utime.h>
 #define unlink _unlink
 #else
 #include <unistd.h>
 #endif
 
+/* Memory-map archive inputs instead of copying them into the heap */
+#ifndef STBUP_USE_MMAP
+#ifdef _WIN32
+#define STBUP_USE_MMAP 0
+#else
+#define STBUP_USE_MMAP 1
+#endif
+#endif
+
+/* Create output files with openat/mkdirat relative to cached directory fds */
+#ifndef STBUP_USE_DIRFD
+#ifdef _WIN32
+#define STBUP_USE_DIRFD 0
+#else
+#define STBUP_USE_DIRFD 1
+#endif
+#endif
+
+/* Write output files with open/write on a descriptor instead of stdio */
+#ifndef STBUP_USE_FD_WRITER
+#ifdef _WIN32
+#define STBUP_USE_FD_WRITER 0
+#else
+#define STBUP_USE_FD_WRITER 1
+#endif
+#endif
+
+#if !defined(_WIN32) || STBUP_USE_MMAP || STBUP_USE_DIRFD || STBUP_USE_FD_WRITER
+#include <fcntl.h>
+#endif
+#if STBUP_USE_MMAP
+#include <sys/mman.h>
+#endif
+#if !defined(_WIN32) || STBUP_USE_DIRFD || STBUP_USE_FD_WRITER
+#include <errno.h>
+#endif
+
+#if STBUP_USE_IO_URING
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if !defined(IORING_FEAT_LINKED_FILE) || !defined(__NR_io_uring_setup)
+/* kernel headers older than 5.18 */
+#undef STBUP_USE_IO_URING
+#define STBUP_USE_IO_URING 0
+#else
+/* there is no libc wrapper; syscall() itself is only declared for _DEFAULT_SOURCE */
+long syscall(long number, ...);
+#endif
+#endif
+
+/* Move plain TAR payloads with in-kernel copies (Linux): out of a mapped archive, and into a created one */
+#ifndef STBUP_USE_COPY_RANGE
+#if defined(__linux__) && STBUP_USE_MMAP
+#define STBUP_USE_COPY_RANGE 1
+#else
+#define STBUP_USE_COPY_RANGE 0
+#endif
+#endif
+
+#if STBUP_USE_COPY_RANGE
+#include <errno.h>
+#include <sys/sendfile.h>
+/* copy_file_range is only declared for _GNU_SOURCE builds on glibc 2.27+ */
+#if defined(_GNU_SOURCE) && defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define STBUP_HAS_COPY_FILE_RANGE 1
+#else
+#define STBUP_HAS_COPY_FILE_RANGE 0
+#endif
+#endif
+
+/* Store only the data extents of sparse files when creating TAR archives */
+#ifndef STBUP_USE_SEEK_HOLE
+#if !defined(_WIN32) && (defined(SEEK_DATA) || defined(__linux__))
+#define STBUP_USE_SEEK_HOLE 1
+#else
+#define STBUP_USE_SEEK_HOLE 0
+#endif
+#endif
+
+/* Flush a durable extraction with one syncfs() instead of a pass of fdatasync calls (Linux) */
+#ifndef STBUP_USE_SYNCFS
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#define STBUP_USE_SYNCFS 1
+#else
+#define STBUP_USE_SYNCFS 0
+#endif
+#endif
+
+/* Swap a durable extraction into place with renameat2(RENAME_EXCHANGE) (Linux) */
+#ifndef STBUP_USE_RENAME_EXCHANGE
+#ifdef __linux__
+#define STBUP_USE_RENAME_EXCHANGE 1
+#else
+#define STBUP_USE_RENAME_EXCHANGE 0
+#endif
+#endif
+
+#if STBUP_USE_RENAME_EXCHANGE
+#include <sys/syscall.h>
+#ifndef __NR_renameat2
+/* kernel headers older than 3.15 */
+#undef STBUP_USE_RENAME_EXCHANGE
+#define STBUP_USE_RENAME_EXCHANGE 0
+#else
+/* glibc only wraps renameat2 for _GNU_SOURCE builds */
+long syscall(long number, ...);
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+#endif
+#endif
+
+#if STBUP_USE_SEEK_HOLE && !defined(SEEK_DATA)
+/* glibc only declares these for _GNU_SOURCE builds */
+#define SEEK_DATA 3
+#define SEEK_HOLE 4
+#endif
+
 /* mkdir -p */
 static int stbup_mkdirs(const char *path)
 {
@@ -95,6 +300,137 @@ static int stbup_mkdirs(const char *path)
     return stbup_mkdir(tmp);
 }
 
+typedef struct
+{
+    uint32_t hash;
+    size_t name; /* offset into names + 1, 0 marks an empty slot */
+} stbup_dir_slot;
+
+/*
+ * Set of directories already created during one extraction, so that each
+ * directory costs one mkdir no matter how many entries live under it.
+ */
+typedef struct
+{
+    stbup_dir_slot *slots;
+    size_t capacity; /* power of two */
+    size_t count;
+    char *names; /* NUL-terminated paths, back to back */
+    size_t names_len;
+    size_t names_cap;
+} stbup_dir_cache;
+
+static uint32_t stbup_hash_path(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u; /* FNV-1a */
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+static void stbup_dir_cache_free(stbup_dir_cache *c)
+{
+    free(c->slots);
+    free(c->names);
+    memset(c, 0, sizeof(*c));
+}
+
+static int stbup_dir_cache_has(const stbup_dir_cache *c, const char *path, size_t len, uint32_t hash)
+{
+    if (c->count == 0)
+        return 0;
+    for (size_t i = hash & (c->capacity - 1);; i = (i + 1) & (c->capacity - 1))
+    {
+        if (c->slots[i].name == 0)
+            return 0;
+        if (c->slots[i].hash == hash)
+        {
+            const char *name = c->names + c->slots[i].name - 1;
+            if (strncmp(name, path, len) == 0 && name[len] == 0)
+                return 1;
+        }
+    }
+}
+
+/* Remember a directory; if the set cannot grow it only costs a repeated mkdir later */
+static void stbup_dir_cache_add(stbup_dir_cache *c, const char *path, size_t len, uint32_t hash)
+{
+    if ((c->count + 1) * 2 > c->capacity)
+    {
+        size_t capacity = c->capacity ? c->capacity * 2 : 64;
+        stbup_dir_slot *slots = (stbup_dir_slot *)calloc(capacity, sizeof(stbup_dir_slot));
+        if (!slots)
+            return;
+        for (size_t i = 0; i < c->capacity; i++)
+        {
+            if (c->slots[i].name == 0)
+                continue;
+            size_t j = c->slots[i].hash & (capacity - 1);
+            while (slots[j].name != 0)
+                j = (j + 1) & (capacity - 1);
+            slots[j] = c->slots[i];
+        }
+        free(c->slots);
+        c->slots = slots;
+        c->capacity = capacity;
+    }
+
+    if (c->names_len + len + 1 > c->names_cap)
+    {
+        size_t cap = c->names_cap ? c->names_cap : 4096;
+        while (cap < c->names_len + len + 1)
+            cap *= 2;
+        char *names = (char *)realloc(c->names, cap);
+        if (!names)
+            return;
+        c->names = names;
+        c->names_cap = cap;
+    }
+
+    memcpy(c->names + c->names_len, path, len);
+    c->names[c->names_len + len] = 0;
+
+    size_t i = hash & (c->capacity - 1);
+    while (c->slots[i].name != 0)
+        i = (i + 1) & (c->capacity - 1);
+    c->slots[i].hash = hash;
+    c->slots[i].name = c->names_len + 1;
+    c->names_len += len + 1;
+    c->count++;
+}
+
+/* mkdir -p, skipping every prefix this extraction has already created */
+static int stbup_mkdirs_cached(stbup_dir_cache *c, const char *path)
+{
+    size_t len = strlen(path);
+    if (!c)
+        return stbup_mkdirs(path);
+    if (len >= STBUP_PATH_MAX)
+        return 0;
+    if (stbup_dir_cache_has(c, path, len, stbup_hash_path(path, len)))
+        return 1;
+
+    char tmp[STBUP_PATH_MAX];
+    memcpy(tmp, path, len + 1);
+
+    for (size_t i = 1; i <= len; i++)
+    {
+        if (i < len && tmp[i] != '/' && tmp[i] != '\\')
+            continue;
+        char c_sep = tmp[i];
+        tmp[i] = 0;
+        uint32_t hash = stbup_hash_path(tmp, i);
+        if (!stbup_dir_cache_has(c, tmp, i, hash))
+        {
+            if (!stbup_mkdir(tmp))
+                return 0;
+            stbup_dir_cache_add(c, tmp, i, hash);
+        }
+        tmp[i] = c_sep;
+    }
+    return 1;
+}
+
 static int stbup_is_path_sep(char c)
 {
     return c == '/' || c == '\\';
@@ -105,10 +441,15 @@ static int stbup_is_drive_letter(char c)
     return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
 }
 
-/* Join base directory with a relative entry path while preventing traversal */
-static int stbup_path_join_safe(char *dst, size_t dst_size, const char *base, const char *entry)
+/*
+ * Normalize an archive entry name into a relative path: '.' and empty
+ * components are dropped, '..' is resolved, separators become '/'.
+ * Fails on absolute paths, drive letters and anything that climbs out of
+ * the root. 'normalized' must hold STBUP_PATH_MAX bytes.
+ */
+static int stbup_entry_path(const char *entry, char *normalized)
 {
-    if (!dst || !base || !entry || dst_size == 0)
+    if (!entry)
         return 0;
 
     while (stbup_is_path_sep(*entry))
@@ -123,7 +464,6 @@ static int stbup_path_join_safe(char *dst, size_t dst_size, const char *base, co
     if (stbup_is_drive_letter(entry[0]) && entry[1] == ':')
         return 0;
 
-    char normalized[STBUP_PATH_MAX];
     size_t component_starts[STBUP_MAX_PATH_COMPONENTS];
     size_t depth = 0;
     size_t norm_len = 0;
@@ -163,14 +503,14 @@ static int stbup_path_join_safe(char *dst, size_t dst_size, const char *base, co
         if (depth >= STBUP_MAX_PATH_COMPONENTS)
             return 0;
 
-        if (norm_len && norm_len + 1 >= sizeof(normalized))
+        if (norm_len && norm_len + 1 >= STBUP_PATH_MAX)
             return 0;
         if (norm_len)
             normalized[norm_len++] = '/';
 
         component_starts[depth++] = norm_len;
 
-        if (norm_len + comp_len >= sizeof(normalized))
+        if (norm_len + comp_len >= STBUP_PATH_MAX)
             return 0;
 
         memcpy(normalized + norm_len, component_start, comp_len);
@@ -178,9 +518,13 @@ static int stbup_path_join_safe(char *dst, size_t dst_size, const char *base, co
         normalized[norm_len] = 0;
     }
 
-    if (norm_len == 0)
-        return 0;
+    return norm_len != 0;
+}
 
+/* Join a base directory and an already normalized relative path */
+static int stbup_path_join(char *dst, size_t dst_size, const char *base, const char *rel)
+{
+    size_t norm_len = strlen(rel);
     size_t base_len = strlen(base);
     if (base_len >= dst_size)
         return 0;
@@ -196,11 +540,23 @@ static int stbup_path_join_safe(char *dst, size_t dst_size, const char *base, co
     if (base_len + norm_len >= dst_size)
         return 0;
 
-    memcpy(dst + base_len, normalized, norm_len);
+    memcpy(dst + base_len, rel, norm_len);
     dst[base_len + norm_len] = 0;
     return 1;
 }
 
+/* Join base directory with a relative entry path while preventing traversal */
+static int stbup_path_join_safe(char *dst, size_t dst_size, const char *base, const char *entry)
+{
+    if (!dst || !base || !entry || dst_size == 0)
+        return 0;
+
+    char normalized[STBUP_PATH_MAX];
+    if (!stbup_entry_path(entry, normalized))
+        return 0;
+    return stbup_path_join(dst, dst_size, base, normalized);
+}
+
 /* get directory part of path */
 static void stbup_dirname(char *path)
 {
@@ -220,6 +576,35 @@ static void stbup_dirname(char *path)
         path[0] = 0;
 }
 
+#ifndef _WIN32
+/* rm -rf; symlinks are removed, never followed */
+static int stbup_remove_tree(const char *path)
+{
+    struct stat st;
+    if (lstat(path, &st) != 0)
+        return errno == ENOENT;
+    if (!S_ISDIR(st.st_mode))
+        return unlink(path) == 0;
+
+    int ok = 1;
+    DIR *d = opendir(path);
+    if (!d)
+        return 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL)
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        char child[STBUP_PATH_MAX];
+        if (!stbup_path_join(child, sizeof(child), path, de->d_name) ||
+            !stbup_remove_tree(child))
+            ok = 0;
+    }
+    closedir(d);
+    return rmdir(path) == 0 && ok;
+}
+#endif
+
 /**
  * Normalize and validate a path to prevent path traversal attacks.
  *
@@ -233,425 +618,5258 @@ static int stbup_normalize_path(const char *entry_name, const char *out_dir, cha
     return stbup_path_join_safe(normalized_path, STBUP_PATH_MAX, out_dir, entry_name);
 }
 
-static int stbup_write_file(const char *path, const void *data, size_t size)
+static int stbup_read_file(const char *path, void **data, size_t *size)
 {
-    FILE *f = fopen(path, "wb");
+    FILE *f = fopen(path, "rb");
     if (!f)
         return 0;
-    size_t written = fwrite(data, 1, size, f);
-    fclose(f);
-    return (written == size);
-}
-
-/* ============================================================
-   TAR format
-   ============================================================ */
 
-typedef struct
-{
-    char name[100];
-    char mode[8];
-    char uid[8];
-    char gid[8];
-    char size[12];
-    char mtime[12];
-    char chksum[8];
-    char typeflag;
-    char linkname[100];
-    char magic[6];
-    char version[2];
-    char uname[32];
-    char gname[32];
-    char devmajor[8];
-    char devminor[8];
-    char prefix[155];
-} stbup_tar_header;
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
 
-/* octal ASCII → integer */
-static uint64_t stbup_octal_to_u64(const char *s, size_t n)
-{
-    uint64_t v = 0;
-    while (n-- && *s)
+    if (sz < 0)
     {
-        if (*s >= '0' && *s <= '7')
-            v = (v << 3) + (*s - '0');
-        else if (*s != ' ' && *s != '\0')
-            break; /* stop at non-octal, non-padding chars */
-        s++;
+        fclose(f);
+        return 0;
     }
-    return v;
-}
-
-/* integer → octal ASCII (null-terminated with leading zeros, TAR format) */
-static void stbup_u64_to_octal(char *dst, size_t dst_size, uint64_t v)
-{
-    /* TAR format: null-terminated octal with leading zeros, no trailing spaces */
-    char tmp[32];
-    int i = sizeof(tmp) - 1;
-    tmp[i] = 0;
 
-    if (v == 0)
+    void *buf = malloc((size_t)sz);
+    if (!buf)
     {
-        tmp[--i] = '0';
+        fclose(f);
+        return 0;
     }
-    else
+
+    if (fread(buf, 1, (size_t)sz, f) != (size_t)sz)
     {
-        while (v > 0 && i > 0)
-        {
-            tmp[--i] = '0' + (v & 7);
-            v >>= 3;
-        }
+        free(buf);
+        fclose(f);
+        return 0;
     }
 
-    /* Pad with leading zeros to fill the field, then null-terminate */
-    int len = sizeof(tmp) - i - 1;
-    int pad = (int)dst_size - 1 - len; /* -1 for null terminator */
-    if (pad < 0)
-        pad = 0;
+    fclose(f);
+    *data = buf;
+    *size = (size_t)sz;
+    return 1;
+}
 
-    memset(dst, '0', pad);
-    memcpy(dst + pad, tmp + i, len);
-    dst[dst_size - 1] = 0;
+/* fseek to an absolute 64-bit offset */
+static int stbup_fseek64(FILE *f, uint64_t offset)
+{
+#ifdef _WIN32
+    return offset <= (uint64_t)INT64_MAX && _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+    off_t off = (off_t)offset;
+    return off >= 0 && (uint64_t)off == offset && fseeko(f, off, SEEK_SET) == 0;
+#endif
 }
 
-/* calculate TAR header checksum */
-static unsigned int stbup_tar_checksum(const stbup_tar_header *h)
+/* Current position of a file */
+static int stbup_ftell64(FILE *f, uint64_t *pos)
 {
-    unsigned int sum = 0;
-    const unsigned char *p = (const unsigned char *)h;
-    size_t struct_size = sizeof(stbup_tar_header);
-    /* Calculate over 512 bytes: struct (500 bytes) + 12 bytes padding (zeros) */
-    for (int i = 0; i < 512; i++)
-    {
-        if (i >= 148 && i < 156)
-        { /* checksum field itself (bytes 148-155) - treat as all spaces */
-            sum += ' ';
-        }
-        else if (i < (int)struct_size)
+#ifdef _WIN32
+    __int64 at = _ftelli64(f);
+#else
+    off_t at = ftello(f);
+#endif
+    if (at < 0)
+        return 0;
+    *pos = (uint64_t)at;
+    return 1;
+}
+
+/* Size of an open file; leaves the position undefined */
+static int stbup_fsize64(FILE *f, uint64_t *size)
+{
+#ifdef _WIN32
+    if (_fseeki64(f, 0, SEEK_END) != 0)
+        return 0;
+    __int64 end = _ftelli64(f);
+#else
+    if (fseeko(f, 0, SEEK_END) != 0)
+        return 0;
+    off_t end = ftello(f);
+#endif
+    if (end < 0)
+        return 0;
+    *size = (uint64_t)end;
+    return 1;
+}
+
+/* Read-only view of a whole input file */
+typedef struct
+{
+    const void *data;
+    size_t size;
+    int mapped; /* 1 if data is a memory mapping, 0 if it is a heap copy */
+    int fd;     /* the mapped file, kept open for kernel copies; -1 for heap copies */
+} stbup_file_view;
+
+/*
+ * Map a file read-only and hint the kernel that it will be read front to
+ * back, so extraction runs straight over the page cache. Returns 0 if the
+ * file cannot be mapped (unsupported platform, empty or special file).
+ */
+static int stbup_file_view_map(stbup_file_view *v, const char *path)
+{
+    memset(v, 0, sizeof(*v));
+    v->fd = -1;
+#if STBUP_USE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+        (uint64_t)st.st_size > (uint64_t)SIZE_MAX)
+    {
+        close(fd);
+        return 0;
+    }
+
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        close(fd);
+        return 0;
+    }
+    posix_madvise(p, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    v->data = p;
+    v->size = (size_t)st.st_size;
+    v->mapped = 1;
+    v->fd = fd;
+    return 1;
+#else
+    (void)path;
+    return 0;
+#endif
+}
+
+/* Map a file, falling back to reading it into memory */
+static int stbup_file_view_open(stbup_file_view *v, const char *path)
+{
+    if (stbup_file_view_map(v, path))
+        return 1;
+
+    void *data = NULL;
+    size_t size = 0;
+    if (!stbup_read_file(path, &data, &size))
+        return 0;
+    v->data = data;
+    v->size = size;
+    v->mapped = 0;
+    return 1;
+}
+
+static void stbup_file_view_close(stbup_file_view *v)
+{
+#if STBUP_USE_MMAP
+    if (v->mapped)
+    {
+        munmap((void *)v->data, v->size);
+        close(v->fd);
+    }
+    else
+#endif
+        free((void *)v->data);
+    memset(v, 0, sizeof(*v));
+    v->fd = -1;
+}
+
+/* Output file being written */
+typedef struct
+{
+#if STBUP_USE_FD_WRITER
+    int fd;
+    unsigned char *buf; /* gathers small writes, allocated on first use */
+    size_t len;
+#else
+    FILE *f;
+#endif
+    int64_t mtime;     /* stamped on close unless -1 */
+    uint64_t pos;      /* bytes written or skipped so far */
+    uint64_t reserved; /* size preallocated up front; cut back to pos on close */
+    int hole;      /* pos is past the last write: seek before the next, set the size on close */
+    int sparse;    /* skip whole zero blocks instead of writing them */
+} stbup_ofile;
+
+/*
+ * Open 'name' for writing, relative to dir_fd or as a plain path when
+ * dir_fd is -1. The descriptor writer opens with O_CLOEXEC and bypasses
+ * stdio, since entries are mostly written from buffers that are already
+ * complete in memory.
+ */
+static int stbup_ofile_open(stbup_ofile *f, int dir_fd, const char *name)
+{
+    memset(f, 0, sizeof(*f));
+    f->mtime = -1;
+    (void)dir_fd;
+#if STBUP_USE_FD_WRITER
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#if STBUP_USE_DIRFD
+    if (dir_fd >= 0)
+        f->fd = openat(dir_fd, name, flags, 0666);
+    else
+#endif
+        f->fd = open(name, flags, 0666);
+    return f->fd >= 0;
+#else
+#if STBUP_USE_DIRFD
+    if (dir_fd >= 0)
+    {
+        int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0)
+            return 0;
+        f->f = fdopen(fd, "wb");
+        if (!f->f)
+            close(fd);
+        return f->f != NULL;
+    }
+#endif
+    f->f = fopen(name, "wb");
+    return f->f != NULL;
+#endif
+}
+
+#if STBUP_USE_FD_WRITER
+/* write() until everything is out, riding over EINTR and short writes */
+static int stbup_write_all(int fd, const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+    while (size > 0)
+    {
+        size_t n = size < (size_t)1 << 30 ? size : (size_t)1 << 30;
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return 0;
+        p += w;
+        size -= (size_t)w;
+    }
+    return 1;
+}
+#endif
+
+/*
+ * Tell the filesystem the final size up front, so a large entry gets a few
+ * contiguous extents instead of growing one write at a time. Best effort:
+ * if it is not supported the writes allocate as usual. Only for sizes the
+ * input is known to back, since an entry that fails leaves the space
+ * allocated until close cuts the file back to what was written.
+ */
+static void stbup_ofile_reserve(stbup_ofile *f, uint64_t size)
+{
+#if STBUP_USE_FD_WRITER && !defined(__APPLE__)
+    if (size < STBUP_PREALLOC_MIN || size > (uint64_t)INT64_MAX)
+        return;
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    /* fallocate fails outright where posix_fallocate would emulate it block by block */
+    if (fallocate(f->fd, 0, 0, (off_t)size) == 0)
+        f->reserved = size;
+#else
+    if (posix_fallocate(f->fd, 0, (off_t)size) == 0)
+        f->reserved = size;
+#endif
+#else
+    (void)f;
+    (void)size;
+#endif
+}
+
+#if STBUP_USE_FD_WRITER
+static int stbup_ofile_flush(stbup_ofile *f)
+{
+    int ok = stbup_write_all(f->fd, f->buf, f->len);
+    f->len = 0;
+    return ok;
+}
+#endif
+
+/* Leave everything up to 'pos' unwritten; the gap becomes a hole */
+static void stbup_ofile_skip(stbup_ofile *f, uint64_t pos)
+{
+    if (pos > f->pos)
+    {
+        f->pos = pos;
+        f->hole = 1;
+    }
+}
+
+/* Append to the file; small pieces are gathered into STBUP_STREAM_CHUNK writes */
+static int stbup_ofile_put(stbup_ofile *f, const void *data, size_t size)
+{
+    if (f->hole)
+    {
+        /* what is buffered belongs before the hole */
+        f->hole = 0;
+#if STBUP_USE_FD_WRITER
+        if (!stbup_ofile_flush(f) || lseek(f->fd, (off_t)f->pos, SEEK_SET) < 0)
+            return 0;
+#else
+        if (!stbup_fseek64(f->f, f->pos))
+            return 0;
+#endif
+    }
+    f->pos += size;
+#if STBUP_USE_FD_WRITER
+    if (f->len + size > STBUP_STREAM_CHUNK && f->len && !stbup_ofile_flush(f))
+        return 0;
+    if (size >= STBUP_STREAM_CHUNK)
+        return stbup_write_all(f->fd, data, size);
+    if (!f->buf)
+    {
+        f->buf = (unsigned char *)malloc(STBUP_STREAM_CHUNK);
+        if (!f->buf)
+            return stbup_write_all(f->fd, data, size);
+    }
+    memcpy(f->buf + f->len, data, size);
+    f->len += size;
+    return 1;
+#else
+    return fwrite(data, 1, size, f->f) == size;
+#endif
+}
+
+static int stbup_is_zero(const unsigned char *p, size_t n)
+{
+    return n == 0 || (p[0] == 0 && memcmp(p, p + 1, n - 1) == 0);
+}
+
+/*
+ * Append to the file. In sparse mode every STBUP_SPARSE_BLOCK-aligned
+ * block of zeros is skipped, so it becomes a hole rather than allocated
+ * zeros; the runs of data in between are written as usual.
+ */
+static int stbup_ofile_write(stbup_ofile *f, const void *data, size_t size)
+{
+    if (!f->sparse)
+        return stbup_ofile_put(f, data, size);
+
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *run = p; /* data not written yet */
+    while (size > 0)
+    {
+        uint64_t at = f->pos + (uint64_t)(p - run);
+        size_t n = STBUP_SPARSE_BLOCK - (size_t)(at % STBUP_SPARSE_BLOCK);
+        if (n > size)
+            n = size;
+        if (n == STBUP_SPARSE_BLOCK && stbup_is_zero(p, n))
+        {
+            if (p > run && !stbup_ofile_put(f, run, (size_t)(p - run)))
+                return 0;
+            stbup_ofile_skip(f, f->pos + n);
+            run = p + n;
+        }
+        p += n;
+        size -= n;
+    }
+    return p == run || stbup_ofile_put(f, run, (size_t)(p - run));
+}
+
+/* Give the file its final size when it ends in a hole */
+static int stbup_ofile_truncate(stbup_ofile *f)
+{
+#ifdef _WIN32
+    return fflush(f->f) == 0 && _chsize_s(_fileno(f->f), (__int64)f->pos) == 0;
+#elif STBUP_USE_FD_WRITER
+    return ftruncate(f->fd, (off_t)f->pos) == 0;
+#else
+    return fflush(f->f) == 0 && ftruncate(fileno(f->f), (off_t)f->pos) == 0;
+#endif
+}
+
+/* Set the modification time of an open file, leaving the access time alone */
+static int stbup_fd_set_mtime(int fd, int64_t mtime)
+{
+#ifdef _WIN32
+    struct _utimbuf ut;
+    ut.actime = time(NULL);
+    ut.modtime = (time_t)mtime;
+    return _futime(fd, &ut) == 0;
+#else
+    struct timespec ts[2];
+    ts[0].tv_sec = 0;
+    ts[0].tv_nsec = UTIME_OMIT;
+    ts[1].tv_sec = (time_t)mtime;
+    ts[1].tv_nsec = 0;
+    return futimens(fd, ts) == 0;
+#endif
+}
+
+#ifndef _WIN32
+/* The same for a path relative to dir_fd (or AT_FDCWD) */
+static int stbup_set_mtime_at(int dir_fd, const char *path, int64_t mtime)
+{
+    struct timespec ts[2];
+    ts[0].tv_sec = 0;
+    ts[0].tv_nsec = UTIME_OMIT;
+    ts[1].tv_sec = (time_t)mtime;
+    ts[1].tv_nsec = 0;
+    return utimensat(dir_fd, path, ts, 0) == 0;
+}
+#endif
+
+/* Flush and close; returns 0 if any of it failed */
+static int stbup_ofile_close(stbup_ofile *f)
+{
+#if STBUP_USE_FD_WRITER
+    int ok = stbup_ofile_flush(f);
+    /* ends in a hole, or short of the reservation because the entry failed */
+    if ((f->hole || f->pos < f->reserved) && !stbup_ofile_truncate(f))
+        ok = 0;
+    /* after the last write, or the write would move it again */
+    if (ok && f->mtime >= 0 && !stbup_fd_set_mtime(f->fd, f->mtime))
+        ok = 0;
+    if (close(f->fd) != 0)
+        ok = 0;
+    free(f->buf);
+    f->buf = NULL;
+    f->fd = -1;
+    return ok;
+#else
+    int ok = (fflush(f->f) == 0);
+    if (ok && f->hole && !stbup_ofile_truncate(f))
+        ok = 0;
+    if (ok && f->mtime >= 0 && !stbup_fd_set_mtime(fileno(f->f), f->mtime))
+        ok = 0;
+    if (fclose(f->f) != 0)
+        ok = 0;
+    f->f = NULL;
+    return ok;
+#endif
+}
+
+#if STBUP_USE_COPY_RANGE
+/*
+ * Move up to 'size' bytes at 'src_offset' in src_fd to the current position
+ * of out_fd in the kernel, with copy_file_range (which may share extents
+ * instead of copying) or else sendfile. Returns how many bytes were moved;
+ * the caller writes the rest itself.
+ */
+static uint64_t stbup_fd_copy(int out_fd, int src_fd, uint64_t src_offset, uint64_t size)
+{
+    const uint64_t step = (uint64_t)1 << 30; /* both calls take a size_t count */
+    uint64_t done = 0;
+    off_t off = (off_t)src_offset;
+#if STBUP_HAS_COPY_FILE_RANGE
+    while (done < size)
+    {
+        ssize_t n = copy_file_range(src_fd, &off, out_fd, NULL,
+                                    (size_t)(size - done < step ? size - done : step), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; /* EXDEV, ENOSYS, EOPNOTSUPP...: try sendfile */
+        done += (uint64_t)n;
+    }
+#endif
+    while (done < size)
+    {
+        ssize_t n = sendfile(out_fd, src_fd, &off, (size_t)(size - done < step ? size - done : step));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += (uint64_t)n;
+    }
+    return done;
+}
+#endif
+
+/* stbup_fd_copy into a freshly opened file; a src_fd of -1 moves nothing */
+static size_t stbup_ofile_copy(stbup_ofile *f, int src_fd, uint64_t src_offset, size_t size)
+{
+    size_t done = 0;
+#if STBUP_USE_COPY_RANGE
+    if (src_fd >= 0 && size > 0)
+    {
+#if STBUP_USE_FD_WRITER
+        int out_fd = f->fd;
+#else
+        int out_fd = fileno(f->f);
+#endif
+        done = (size_t)stbup_fd_copy(out_fd, src_fd, src_offset, size);
+        f->pos += done;
+    }
+#else
+    (void)f;
+    (void)src_fd;
+    (void)src_offset;
+    (void)size;
+#endif
+    return done;
+}
+
+/*
+ * Write 'size' bytes to a freshly opened file. The same bytes are at 'data'
+ * in memory and, when src_fd is not -1, at 'src_offset' in src_fd: then
+ * they are moved by stbup_ofile_copy and only the remainder is written
+ * from memory.
+ */
+static int stbup_write_range(stbup_ofile *f, int src_fd, uint64_t src_offset,
+                             const void *data, size_t size)
+{
+    size_t done = stbup_ofile_copy(f, src_fd, src_offset, size);
+    if (done == size)
+        return 1;
+    f->pos += size - done;
+#if STBUP_USE_FD_WRITER
+    return stbup_write_all(f->fd, (const char *)data + done, size - done);
+#else
+    return fwrite((const char *)data + done, 1, size - done, f->f) == size - done;
+#endif
+}
+
+/* ============================================================
+   Output directory
+   ============================================================ */
+
+/*
+ * Extraction target. Entries are addressed by normalized paths relative to
+ * the output root. With STBUP_USE_DIRFD the root is opened once and the
+ * most recently used subdirectories are kept open, so each file costs an
+ * openat() of its basename instead of a lookup of the whole joined path.
+ * If the root cannot be opened this falls back to full-path calls.
+ */
+typedef struct
+{
+    char rel[STBUP_PATH_MAX]; /* directory relative to the root */
+    int fd;                   /* -1 if the slot is free */
+    unsigned long last_used;
+} stbup_dirfd_slot;
+
+typedef struct
+{
+    const char *dir;      /* output root as given by the caller */
+    int root_fd;          /* -2 until first use, -1 when using full paths */
+    stbup_dir_cache made; /* directories known to exist */
+    stbup_dirfd_slot fds[STBUP_DIRFD_CACHE];
+    unsigned long tick;
+    char final_dir[STBUP_PATH_MAX]; /* durable mode: where the root goes on commit, else empty */
+    char staging[STBUP_PATH_MAX];   /* durable mode: the root until it is committed */
+    int sync_threads;               /* durable mode: threads for the fdatasync pass */
+} stbup_out;
+
+static void stbup_out_init(stbup_out *o, const char *dir)
+{
+    memset(o, 0, sizeof(*o));
+    o->dir = dir;
+    o->root_fd = -2;
+    for (int i = 0; i < STBUP_DIRFD_CACHE; i++)
+        o->fds[i].fd = -1;
+}
+
+/* Close the cached directory fds; the next use reopens the root */
+static void stbup_out_close_dirs(stbup_out *o)
+{
+#if STBUP_USE_DIRFD
+    for (int i = 0; i < STBUP_DIRFD_CACHE; i++)
+    {
+        if (o->fds[i].fd >= 0)
+            close(o->fds[i].fd);
+        o->fds[i].fd = -1;
+    }
+    if (o->root_fd >= 0)
+        close(o->root_fd);
+#endif
+    o->root_fd = -2;
+}
+
+/* Release the output; a durable extraction that was not committed is thrown away */
+static void stbup_out_free(stbup_out *o)
+{
+    stbup_out_close_dirs(o);
+    stbup_dir_cache_free(&o->made);
+#ifndef _WIN32
+    if (o->staging[0])
+        stbup_remove_tree(o->staging);
+#endif
+    o->staging[0] = 0;
+}
+
+/*
+ * Durable mode: extract into a fresh staging directory beside 'dir', to be
+ * synced and swapped in by stbup_out_commit. Call right after init.
+ */
+static void stbup_out_durable(stbup_out *o, int sync_threads)
+{
+    size_t len = strlen(o->dir);
+    while (len > 1 && o->dir[len - 1] == '/')
+        len--; /* "out/" and "out" name the same directory */
+    if (len == 0 || len >= sizeof(o->final_dir))
+        memcpy(o->final_dir, ".", 2); /* refused by stbup_out_stage */
+    else
+    {
+        memcpy(o->final_dir, o->dir, len);
+        o->final_dir[len] = 0;
+    }
+    o->sync_threads = sync_threads;
+}
+
+#ifndef _WIN32
+/* Create the staging directory and make it the output root */
+static int stbup_out_stage(stbup_out *o)
+{
+    char parent[STBUP_PATH_MAX];
+    memcpy(parent, o->final_dir, strlen(o->final_dir) + 1);
+    stbup_dirname(parent);
+    const char *base = o->final_dir + (parent[0] ? strlen(parent) + 1 : 0);
+    if (!base[0] || strcmp(base, ".") == 0 || strcmp(base, "..") == 0 || strcmp(base, "/") == 0)
+        return 0; /* nothing that could be renamed */
+    if (parent[0] && !stbup_mkdirs(parent))
+        return 0;
+    /* not mkdtemp: that would give the new tree mode 0700 instead of the umask's */
+    static unsigned int counter;
+    for (int attempt = 0; attempt < 100; attempt++)
+    {
+        int n = snprintf(o->staging, sizeof(o->staging), "%s.stbup-%ld-%u", o->final_dir,
+                         (long)getpid(), counter++);
+        if (n < 0 || (size_t)n >= sizeof(o->staging))
+            break;
+        if (mkdir(o->staging, 0755) == 0)
+        {
+            o->dir = o->staging;
+            return 1;
+        }
+        if (errno != EEXIST)
+            break;
+    }
+    o->staging[0] = 0;
+    return 0;
+}
+#endif
+
+/* Create the output root on first use and open it if possible */
+static int stbup_out_root(stbup_out *o)
+{
+    if (o->root_fd != -2)
+        return 1;
+    if (o->final_dir[0] && !o->staging[0])
+    {
+#ifdef _WIN32
+        return 0; /* durable mode needs POSIX rename semantics */
+#else
+        if (!stbup_out_stage(o))
+            return 0;
+#endif
+    }
+    if (o->dir[0] && !stbup_mkdirs(o->dir))
+        return 0;
+    o->root_fd = -1;
+#if STBUP_USE_DIRFD
+    o->root_fd = open(o->dir[0] ? o->dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (o->root_fd < 0)
+        o->root_fd = -1;
+#endif
+    return 1;
+}
+
+#if STBUP_USE_DIRFD
+/*
+ * Open (creating as needed) directory 'rel', starting from the deepest
+ * ancestor that is already open. The returned fd belongs to the cache and
+ * stays valid until the next call. Returns -1 on failure.
+ */
+static int stbup_out_dirfd(stbup_out *o, const char *rel)
+{
+    size_t len = strlen(rel);
+    if (len == 0)
+        return o->root_fd;
+
+    int base = o->root_fd;
+    size_t start = 0;
+    for (int i = 0; i < STBUP_DIRFD_CACHE; i++)
+    {
+        stbup_dirfd_slot *slot = &o->fds[i];
+        if (slot->fd < 0)
+            continue;
+        size_t n = strlen(slot->rel);
+        if (n <= len && n + 1 > start && memcmp(slot->rel, rel, n) == 0 &&
+            (rel[n] == 0 || rel[n] == '/'))
+        {
+            slot->last_used = ++o->tick;
+            if (n == len)
+                return slot->fd;
+            base = slot->fd;
+            start = n + 1;
+        }
+    }
+
+    char tmp[STBUP_PATH_MAX];
+    memcpy(tmp, rel, len + 1);
+    int fd = -1;
+
+    if (stbup_dir_cache_has(&o->made, tmp, len, stbup_hash_path(tmp, len)))
+    {
+        /* the whole chain exists already: a single lookup will do */
+        fd = openat(base, tmp + start, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    else
+    {
+        /* walk down one component at a time, creating what is missing */
+        int cur = base;
+        size_t i = start;
+        while (i <= len)
+        {
+            size_t j = i;
+            while (j < len && tmp[j] != '/')
+                j++;
+            tmp[j] = 0;
+            uint32_t hash = stbup_hash_path(tmp, j);
+            if (!stbup_dir_cache_has(&o->made, tmp, j, hash))
+            {
+                if (mkdirat(cur, tmp + i, 0755) != 0 && errno != EEXIST)
+                    break;
+                stbup_dir_cache_add(&o->made, tmp, j, hash);
+            }
+            int next = openat(cur, tmp + i, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (cur != base)
+                close(cur);
+            cur = next;
+            if (cur < 0)
+                break;
+            if (j == len)
+                fd = cur;
+            else
+                tmp[j] = '/';
+            i = j + 1;
+        }
+        if (fd < 0 && cur >= 0 && cur != base)
+            close(cur);
+    }
+    if (fd < 0)
+        return -1;
+
+    /* keep it open, evicting the least recently used directory */
+    stbup_dirfd_slot *victim = &o->fds[0];
+    for (int i = 0; i < STBUP_DIRFD_CACHE; i++)
+    {
+        if (o->fds[i].fd < 0)
+        {
+            victim = &o->fds[i];
+            break;
+        }
+        if (o->fds[i].last_used < victim->last_used)
+            victim = &o->fds[i];
+    }
+    if (victim->fd >= 0)
+        close(victim->fd);
+    memcpy(victim->rel, rel, len + 1);
+    victim->fd = fd;
+    victim->last_used = ++o->tick;
+    return fd;
+}
+
+#endif
+
+/* mkdir -p for a directory below the output root */
+static int stbup_out_mkdirs(stbup_out *o, const char *rel)
+{
+    if (!stbup_out_root(o))
+        return 0;
+    if (rel[0] == 0)
+        return 1;
+#if STBUP_USE_DIRFD
+    if (o->root_fd >= 0)
+        return stbup_out_dirfd(o, rel) >= 0;
+#endif
+    char full[STBUP_PATH_MAX];
+    if (!stbup_path_join(full, sizeof(full), o->dir, rel))
+        return 0;
+    return stbup_mkdirs_cached(&o->made, full);
+}
+
+/*
+ * Open a file below the output root for writing, reserving 'size' bytes.
+ * 'mkparent' creates the parent directory first; without it the parent
+ * must already exist. Safe to call from several threads at once when
+ * 'mkparent' is 0.
+ */
+static int stbup_out_open(stbup_out *o, const char *rel, int mkparent, uint64_t size,
+                          stbup_ofile *f)
+{
+    int ok;
+    if (mkparent)
+    {
+        char dir[STBUP_PATH_MAX];
+        memcpy(dir, rel, strlen(rel) + 1);
+        stbup_dirname(dir);
+        if (!stbup_out_mkdirs(o, dir))
+            return 0;
+#if STBUP_USE_DIRFD
+        if (o->root_fd >= 0 && dir[0])
+        {
+            int dir_fd = stbup_out_dirfd(o, dir);
+            if (dir_fd < 0)
+                return 0;
+            rel += strlen(dir) + 1;
+            ok = stbup_ofile_open(f, dir_fd, rel);
+            if (ok)
+                stbup_ofile_reserve(f, size);
+            return ok;
+        }
+#endif
+    }
+#if STBUP_USE_DIRFD
+    if (o->root_fd >= 0)
+        ok = stbup_ofile_open(f, o->root_fd, rel);
+    else
+#endif
+    {
+        char full[STBUP_PATH_MAX];
+        if (!stbup_path_join(full, sizeof(full), o->dir, rel))
+            return 0;
+        ok = stbup_ofile_open(f, -1, full);
+    }
+    if (ok)
+        stbup_ofile_reserve(f, size);
+    return ok;
+}
+
+/*
+ * Write a whole file below the output root; the parent must already exist
+ * unless 'mkparent' is set. See stbup_write_range for src_fd/src_offset.
+ * An 'mtime' other than -1 is stamped on the file once it is complete.
+ */
+static int stbup_out_write_file(stbup_out *o, const char *rel, int mkparent, int src_fd,
+                                uint64_t src_offset, const void *data, size_t size,
+                                int64_t mtime)
+{
+    uint64_t reserve = size;
+#if STBUP_USE_COPY_RANGE && STBUP_HAS_COPY_FILE_RANGE
+    if (src_fd >= 0)
+        reserve = 0; /* copy_file_range may share the source extents; reserved ones would be wasted */
+#endif
+    stbup_ofile f;
+    if (!stbup_out_open(o, rel, mkparent, reserve, &f))
+        return 0;
+    f.mtime = mtime;
+    int ok = stbup_write_range(&f, src_fd, src_offset, data, size);
+    if (!stbup_ofile_close(&f))
+        ok = 0;
+    return ok;
+}
+
+/* stat() a path below the output root */
+static int stbup_out_stat(stbup_out *o, const char *rel, struct stat *st)
+{
+    if (!stbup_out_root(o))
+        return 0;
+#if STBUP_USE_DIRFD
+    if (o->root_fd >= 0)
+        return fstatat(o->root_fd, rel, st, 0) == 0;
+#endif
+    char full[STBUP_PATH_MAX];
+    if (!stbup_path_join(full, sizeof(full), o->dir, rel))
+        return 0;
+    return stat(full, st) == 0;
+}
+
+/*
+ * For update mode: is 'rel' already a regular file of this size and
+ * modification time? Extractors in update mode stamp the header mtime on
+ * everything they write, so a second run over the same archive only costs
+ * one stat per entry.
+ */
+static int stbup_out_unchanged(stbup_out *o, const char *rel, uint64_t size, int64_t mtime)
+{
+    struct stat st;
+    if (mtime < 0 || !stbup_out_stat(o, rel, &st))
+        return 0;
+    return (st.st_mode & S_IFMT) == S_IFREG && (uint64_t)st.st_size == size &&
+           (int64_t)st.st_mtime == mtime;
+}
+
+/* Set the modification time of an existing file below the output root */
+static int stbup_out_set_mtime(stbup_out *o, const char *rel, int64_t mtime)
+{
+#ifdef _WIN32
+    char full[STBUP_PATH_MAX];
+    struct _utimbuf ut;
+    if (!stbup_path_join(full, sizeof(full), o->dir, rel))
+        return 0;
+    ut.actime = time(NULL);
+    ut.modtime = (time_t)mtime;
+    return _utime(full, &ut) == 0;
+#else
+    if (!stbup_out_root(o))
+        return 0;
+#if STBUP_USE_DIRFD
+    if (o->root_fd >= 0)
+        return stbup_set_mtime_at(o->root_fd, rel, mtime);
+#endif
+    char full[STBUP_PATH_MAX];
+    if (!stbup_path_join(full, sizeof(full), o->dir, rel))
+        return 0;
+    return stbup_set_mtime_at(AT_FDCWD, full, mtime);
+#endif
+}
+
+/* fsync a file or directory below the output root; file data only needs fdatasync */
+static int stbup_out_sync(stbup_out *o, const char *rel)
+{
+#ifdef _WIN32
+    (void)o;
+    (void)rel;
+    return 0;
+#else
+    char full[STBUP_PATH_MAX];
+    int fd;
+#if STBUP_USE_DIRFD
+    if (o->root_fd >= 0)
+        fd = openat(o->root_fd, rel[0] ? rel : ".", O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    else
+#endif
+    {
+        if (!stbup_path_join(full, sizeof(full), o->dir, rel))
+            return 0;
+        fd = open(full, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    }
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    int ok = fstat(fd, &st) == 0;
+#if defined(__linux__)
+    ok = ok && (S_ISDIR(st.st_mode) ? fsync(fd) : fdatasync(fd)) == 0;
+#else
+    ok = ok && fsync(fd) == 0;
+#endif
+    close(fd);
+    return ok;
+#endif
+}
+
+#ifndef _WIN32
+/*
+ * Name 'rel' for the *at() calls: relative to the open root, or joined
+ * with the root path against AT_FDCWD when full paths are in use.
+ */
+static const char *stbup_out_at(stbup_out *o, const char *rel, char *joined, int *dir_fd)
+{
+    if (!stbup_out_root(o))
+        return NULL;
+    if (o->root_fd >= 0)
+    {
+        *dir_fd = o->root_fd;
+        return rel;
+    }
+    *dir_fd = AT_FDCWD;
+    return stbup_path_join(joined, STBUP_PATH_MAX, o->dir, rel) ? joined : NULL;
+}
+
+/* Remove a file or link at 'rel' so a link can take its place */
+static int stbup_out_unlink(stbup_out *o, const char *rel)
+{
+    char joined[STBUP_PATH_MAX];
+    int dir_fd;
+    const char *path = stbup_out_at(o, rel, joined, &dir_fd);
+    return path && (unlinkat(dir_fd, path, 0) == 0 || errno == ENOENT);
+}
+
+/*
+ * Hard link 'rel' to 'target', a file extracted earlier, replacing what
+ * is there. In update mode a link that already shares the inode is kept.
+ */
+static int stbup_out_link(stbup_out *o, const char *target, const char *rel, int update)
+{
+    char dir[STBUP_PATH_MAX];
+    memcpy(dir, rel, strlen(rel) + 1);
+    stbup_dirname(dir);
+    if (!stbup_out_mkdirs(o, dir))
+        return 0;
+
+    char joined_target[STBUP_PATH_MAX], joined[STBUP_PATH_MAX];
+    int target_fd, dir_fd;
+    const char *from = stbup_out_at(o, target, joined_target, &target_fd);
+    const char *to = stbup_out_at(o, rel, joined, &dir_fd);
+    if (!from || !to)
+        return 0;
+    if (update)
+    {
+        struct stat a, b;
+        if (fstatat(target_fd, from, &a, AT_SYMLINK_NOFOLLOW) == 0 &&
+            fstatat(dir_fd, to, &b, AT_SYMLINK_NOFOLLOW) == 0 &&
+            a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+            return 1;
+    }
+    if (!stbup_out_unlink(o, rel))
+        return 0;
+    /* flags 0: a target that is a symlink is linked itself, not followed */
+    return linkat(target_fd, from, dir_fd, to, 0) == 0;
+}
+
+/*
+ * Does a symlink at 'rel' pointing to 'target' stay below the root? The
+ * target is held to the entry path rules once resolved against the link's
+ * directory. '..' after a named component is refused as well: that name
+ * may itself be a symlink, and the kernel would not end up where the
+ * lexical resolution does.
+ */
+static int stbup_symlink_target_ok(const char *rel, const char *target)
+{
+    if (!target[0] || stbup_is_path_sep(target[0]) ||
+        (stbup_is_drive_letter(target[0]) && target[1] == ':'))
+        return 0;
+
+    int named = 0;
+    for (const char *p = target; *p;)
+    {
+        while (stbup_is_path_sep(*p))
+            p++;
+        const char *start = p;
+        while (*p && !stbup_is_path_sep(*p))
+            p++;
+        size_t len = (size_t)(p - start);
+        if (len == 2 && start[0] == '.' && start[1] == '.')
+        {
+            if (named)
+                return 0;
+        }
+        else if (len > 0 && !(len == 1 && start[0] == '.'))
+            named = 1;
+    }
+
+    char dir[STBUP_PATH_MAX], joined[STBUP_PATH_MAX], resolved[STBUP_PATH_MAX];
+    memcpy(dir, rel, strlen(rel) + 1);
+    stbup_dirname(dir);
+    return stbup_path_join(joined, sizeof(joined), dir, target) &&
+           stbup_entry_path(joined, resolved);
+}
+
+/*
+ * Create symlink 'rel' -> 'target' (checked with stbup_symlink_target_ok),
+ * replacing what is there. Every directory on the way to it must be a real
+ * directory, so a link can never be planted through another link. In
+ * update mode a link with the same target is kept.
+ */
+static int stbup_out_symlink(stbup_out *o, const char *rel, const char *target, int update)
+{
+    char dir[STBUP_PATH_MAX];
+    memcpy(dir, rel, strlen(rel) + 1);
+    stbup_dirname(dir);
+    if (!stbup_out_mkdirs(o, dir))
+        return 0;
+
+    char joined[STBUP_PATH_MAX];
+    int dir_fd;
+    const char *path;
+    for (size_t i = 0; dir[i]; i++)
+    {
+        if (dir[i + 1] != '/' && dir[i + 1] != 0)
+            continue;
+        struct stat st;
+        char c = dir[i + 1];
+        dir[i + 1] = 0;
+        path = stbup_out_at(o, dir, joined, &dir_fd);
+        int real = path && fstatat(dir_fd, path, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                   (st.st_mode & S_IFMT) == S_IFDIR;
+        dir[i + 1] = c;
+        if (!real)
+            return 0;
+    }
+
+    path = stbup_out_at(o, rel, joined, &dir_fd);
+    if (!path)
+        return 0;
+    if (update)
+    {
+        char current[STBUP_PATH_MAX];
+        ssize_t n = readlinkat(dir_fd, path, current, sizeof(current) - 1);
+        if (n >= 0 && (size_t)n == strlen(target) && memcmp(current, target, (size_t)n) == 0)
+            return 1;
+    }
+    if (!stbup_out_unlink(o, rel))
+        return 0;
+    return symlinkat(target, dir_fd, path) == 0;
+}
+#endif
+
+/* ============================================================
+   Output sinks
+   ============================================================ */
+
+/*
+ * Destination for extracted entries, used instead of the output directory
+ * when set in stbup_extract_options. Paths are normalized and relative.
+ * For each regular file 'begin' gets its full size, 'write' gets the bytes
+ * in order (holes of sparse files arrive as zeros) and 'end' follows the
+ * last byte; 'end' is not called if extraction fails in between. Links are
+ * not passed on. Every callback returns 1 on success, 0 to abort.
+ */
+typedef struct stbup_sink
+{
+    void *user;
+    int (*begin)(void *user, const char *path, uint64_t size, int64_t mtime);
+    int (*write)(void *user, const void *data, size_t size);
+    int (*end)(void *user);
+    int (*mkdir)(void *user, const char *path);
+} stbup_sink;
+
+/* Sink writing below a directory, as extraction without a sink does */
+typedef struct
+{
+    stbup_sink sink; /* pass &fs->sink in the options */
+    stbup_out out;
+    stbup_ofile file;
+    int open;
+} stbup_fs_sink;
+
+static int stbup_fs_sink_begin(void *user, const char *path, uint64_t size, int64_t mtime)
+{
+    stbup_fs_sink *fs = (stbup_fs_sink *)user;
+    (void)mtime; /* left to the filesystem, as without a sink */
+    (void)size;  /* only what the header claims, so nothing is reserved for it */
+    fs->open = stbup_out_open(&fs->out, path, 1, 0, &fs->file);
+    return fs->open;
+}
+
+static int stbup_fs_sink_write(void *user, const void *data, size_t size)
+{
+    stbup_fs_sink *fs = (stbup_fs_sink *)user;
+    return stbup_ofile_write(&fs->file, data, size);
+}
+
+static int stbup_fs_sink_end(void *user)
+{
+    stbup_fs_sink *fs = (stbup_fs_sink *)user;
+    fs->open = 0;
+    return stbup_ofile_close(&fs->file);
+}
+
+static int stbup_fs_sink_mkdir(void *user, const char *path)
+{
+    stbup_fs_sink *fs = (stbup_fs_sink *)user;
+    return stbup_out_mkdirs(&fs->out, path);
+}
+
+static void stbup_fs_sink_init(stbup_fs_sink *fs, const char *out_dir)
+{
+    memset(fs, 0, sizeof(*fs));
+    stbup_out_init(&fs->out, out_dir);
+    fs->sink.user = fs;
+    fs->sink.begin = stbup_fs_sink_begin;
+    fs->sink.write = stbup_fs_sink_write;
+    fs->sink.end = stbup_fs_sink_end;
+    fs->sink.mkdir = stbup_fs_sink_mkdir;
+}
+
+/* Close a file left open by a failed extraction and release the directory fds */
+static void stbup_fs_sink_free(stbup_fs_sink *fs)
+{
+    if (fs->open)
+        stbup_ofile_close(&fs->file);
+    fs->open = 0;
+    stbup_out_free(&fs->out);
+}
+
+/* An entry collected by the memory sink; everything lives in the arena */
+typedef struct stbup_mem_entry
+{
+    struct stbup_mem_entry *next; /* archive order */
+    const char *path;
+    unsigned char *data; /* NULL for directories */
+    size_t size;
+    int64_t mtime; /* -1 if the archive has none */
+    int is_dir;
+} stbup_mem_entry;
+
+/*
+ * Sink collecting entries into a caller-owned buffer. Each entry takes a
+ * record, its data and its path, carved from the arena in archive order;
+ * extraction fails once the arena is full. Nothing is freed: the entries
+ * stay valid as long as the arena does.
+ */
+typedef struct
+{
+    stbup_sink sink; /* pass &mem->sink in the options */
+    unsigned char *arena;
+    size_t arena_size;
+    size_t used;
+    stbup_mem_entry *first, *last;
+    size_t count;
+    size_t fill; /* bytes written to 'last' so far */
+} stbup_mem_sink;
+
+/* Carve a record for 'path' plus 'size' data bytes from the arena */
+static stbup_mem_entry *stbup_mem_sink_add(stbup_mem_sink *m, const char *path, uint64_t size)
+{
+    if (!m->arena)
+        return NULL;
+    size_t at = m->used + (size_t)(-(uintptr_t)(m->arena + m->used) & 15);
+    size_t head = sizeof(stbup_mem_entry);
+    size_t path_len = strlen(path) + 1;
+    if (at > m->arena_size || head + path_len > m->arena_size - at ||
+        size > m->arena_size - at - head - path_len)
+        return NULL;
+
+    stbup_mem_entry *e = (stbup_mem_entry *)(m->arena + at);
+    memset(e, 0, sizeof(*e));
+    e->data = m->arena + at + head;
+    e->size = (size_t)size;
+    e->mtime = -1;
+    char *dst = (char *)e->data + e->size;
+    memcpy(dst, path, path_len);
+    e->path = dst;
+    m->used = at + head + e->size + path_len;
+
+    if (m->last)
+        m->last->next = e;
+    else
+        m->first = e;
+    m->last = e;
+    m->count++;
+    m->fill = 0;
+    return e;
+}
+
+static int stbup_mem_sink_begin(void *user, const char *path, uint64_t size, int64_t mtime)
+{
+    stbup_mem_entry *e = stbup_mem_sink_add((stbup_mem_sink *)user, path, size);
+    if (e)
+        e->mtime = mtime;
+    return e != NULL;
+}
+
+static int stbup_mem_sink_write(void *user, const void *data, size_t size)
+{
+    stbup_mem_sink *m = (stbup_mem_sink *)user;
+    if (!m->last || size > m->last->size - m->fill)
+        return 0;
+    memcpy(m->last->data + m->fill, data, size);
+    m->fill += size;
+    return 1;
+}
+
+static int stbup_mem_sink_end(void *user)
+{
+    stbup_mem_sink *m = (stbup_mem_sink *)user;
+    return m->last && m->fill == m->last->size;
+}
+
+static int stbup_mem_sink_mkdir(void *user, const char *path)
+{
+    stbup_mem_entry *e = stbup_mem_sink_add((stbup_mem_sink *)user, path, 0);
+    if (!e)
+        return 0;
+    e->data = NULL;
+    e->is_dir = 1;
+    return 1;
+}
+
+static void stbup_mem_sink_init(stbup_mem_sink *m, void *arena, size_t arena_size)
+{
+    memset(m, 0, sizeof(*m));
+    m->arena = (unsigned char *)arena;
+    m->arena_size = arena_size;
+    m->sink.user = m;
+    m->sink.begin = stbup_mem_sink_begin;
+    m->sink.write = stbup_mem_sink_write;
+    m->sink.end = stbup_mem_sink_end;
+    m->sink.mkdir = stbup_mem_sink_mkdir;
+}
+
+/* Latest collected entry with this normalized path, or NULL */
+static const stbup_mem_entry *stbup_mem_sink_find(const stbup_mem_sink *m, const char *path)
+{
+    const stbup_mem_entry *found = NULL;
+    for (const stbup_mem_entry *e = m->first; e; e = e->next)
+    {
+        if (strcmp(e->path, path) == 0)
+            found = e;
+    }
+    return found;
+}
+
+/* ============================================================
+   Extraction options
+   ============================================================ */
+
+/* Optional settings for the *_ex extractors; a zeroed struct (or NULL) gives the defaults */
+typedef struct
+{
+    int num_threads;   /* file writer threads; 0 or 1 writes on the calling thread */
+    int io_uring;      /* 1: batch file writes through io_uring if the kernel supports it */
+    int skip_checksum; /* 1: accept TAR headers without checking their checksum */
+    const char *const *include; /* NULL-terminated globs; if set, only matching entries */
+    const char *const *exclude; /* NULL-terminated globs of entries to leave out */
+    int update;     /* 1: keep files already on disk with the entry's size and mtime */
+    int update_crc; /* 1: in update mode, also keep ZIP entries whose CRC-32 matches */
+    int sparse;     /* 1: leave runs of zero blocks in TAR regular files as holes */
+    const stbup_sink *sink; /* if set, entries go here and the output directory is unused */
+    int durable; /* 1: extract into a staging directory, flush it and swap it in for out_dir */
+    const char *checkpoint;       /* journal for resuming an interrupted TAR or .tar.gz extraction */
+    uint64_t checkpoint_interval; /* archive bytes between checkpoints, 0 for the default */
+} stbup_extract_options;
+
+/* Optional settings for the *_create_dir_ex creators; a zeroed struct (or NULL) gives the defaults */
+typedef struct
+{
+    int num_threads;   /* threads listing directories ahead of the writer; 0 lists on the calling thread */
+    int numeric_owner; /* 1: store only uid and gid, without looking up user and group names */
+    int reproducible;  /* 1: the same tree gives the same bytes (sorted, clamped times, no owners) */
+    int64_t source_date_epoch; /* reproducible: latest mtime stored; 0 takes SOURCE_DATE_EPOCH */
+} stbup_create_options;
+
+/*
+ * Glob match: '*' and '?' stay within one path component, '**' crosses
+ * components, and '**' followed by a slash may also match no directory.
+ */
+static int stbup_glob_match(const char *p, const char *s)
+{
+    for (; *p; p++, s++)
+    {
+        if (*p == '*')
+        {
+            int deep = (p[1] == '*');
+            while (*p == '*')
+                p++;
+            if (deep && *p == '/' && stbup_glob_match(p + 1, s))
+                return 1;
+            for (;; s++)
+            {
+                if (stbup_glob_match(p, s))
+                    return 1;
+                if (!*s || (!deep && *s == '/'))
+                    return 0;
+            }
+        }
+        if (!*s)
+            return 0;
+        if (*p == '?' ? *s == '/' : *p != *s)
+            return 0;
+    }
+    return *s == 0;
+}
+
+/*
+ * Does a pattern select this path? A pattern naming a directory selects
+ * everything below it: "bin", "bin/" and a star under bin all take the
+ * whole bin tree.
+ */
+static int stbup_glob_match_path(const char *pattern, const char *path)
+{
+    char pat[STBUP_PATH_MAX];
+    char buf[STBUP_PATH_MAX];
+    while (pattern[0] == '.' && pattern[1] == '/')
+        pattern += 2;
+    while (*pattern == '/')
+        pattern++;
+    size_t plen = strlen(pattern);
+    size_t len = strlen(path);
+    if (plen >= sizeof(pat) || len >= sizeof(buf))
+        return 0;
+    while (plen > 0 && pattern[plen - 1] == '/')
+        plen--;
+    memcpy(pat, pattern, plen);
+    pat[plen] = 0;
+    memcpy(buf, path, len + 1);
+
+    for (;;)
+    {
+        if (stbup_glob_match(pat, buf))
+            return 1;
+        while (len > 0 && buf[len] != '/')
+            len--;
+        if (len == 0)
+            return 0;
+        buf[len] = 0;
+    }
+}
+
+/* Is a normalized entry path selected by the include/exclude lists? */
+static int stbup_filter_accepts(const stbup_extract_options *opts, const char *path)
+{
+    if (!opts)
+        return 1;
+    if (opts->include)
+    {
+        const char *const *p = opts->include;
+        while (*p && !stbup_glob_match_path(*p, path))
+            p++;
+        if (!*p)
+            return 0;
+    }
+    if (opts->exclude)
+    {
+        for (const char *const *p = opts->exclude; *p; p++)
+        {
+            if (stbup_glob_match_path(*p, path))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* ============================================================
+   Parallel file writer
+   ============================================================ */
+
+#if STBUP_THREADS
+#ifdef _WIN32
+typedef HANDLE stbup_thread;
+typedef CRITICAL_SECTION stbup_mutex;
+typedef CONDITION_VARIABLE stbup_cond;
+typedef LPTHREAD_START_ROUTINE stbup_thread_fn;
+
+static int stbup_thread_start(stbup_thread *t, stbup_thread_fn fn, void *arg)
+{
+    *t = CreateThread(NULL, 0, fn, arg, 0, NULL);
+    return *t != NULL;
+}
+
+static void stbup_thread_join(stbup_thread t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+static void stbup_mutex_init(stbup_mutex *m) { InitializeCriticalSection(m); }
+static void stbup_mutex_destroy(stbup_mutex *m) { DeleteCriticalSection(m); }
+static void stbup_mutex_lock(stbup_mutex *m) { EnterCriticalSection(m); }
+static void stbup_mutex_unlock(stbup_mutex *m) { LeaveCriticalSection(m); }
+static void stbup_cond_init(stbup_cond *c) { InitializeConditionVariable(c); }
+static void stbup_cond_destroy(stbup_cond *c) { (void)c; }
+static void stbup_cond_wait(stbup_cond *c, stbup_mutex *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static void stbup_cond_broadcast(stbup_cond *c) { WakeAllConditionVariable(c); }
+#else
+#include <pthread.h>
+typedef pthread_t stbup_thread;
+typedef pthread_mutex_t stbup_mutex;
+typedef pthread_cond_t stbup_cond;
+typedef void *(*stbup_thread_fn)(void *);
+
+static int stbup_thread_start(stbup_thread *t, stbup_thread_fn fn, void *arg)
+{
+    return pthread_create(t, NULL, fn, arg) == 0;
+}
+
+static void stbup_thread_join(stbup_thread t) { pthread_join(t, NULL); }
+static void stbup_mutex_init(stbup_mutex *m) { pthread_mutex_init(m, NULL); }
+static void stbup_mutex_destroy(stbup_mutex *m) { pthread_mutex_destroy(m); }
+static void stbup_mutex_lock(stbup_mutex *m) { pthread_mutex_lock(m); }
+static void stbup_mutex_unlock(stbup_mutex *m) { pthread_mutex_unlock(m); }
+static void stbup_cond_init(stbup_cond *c) { pthread_cond_init(c, NULL); }
+static void stbup_cond_destroy(stbup_cond *c) { pthread_cond_destroy(c); }
+static void stbup_cond_wait(stbup_cond *c, stbup_mutex *m) { pthread_cond_wait(c, m); }
+static void stbup_cond_broadcast(stbup_cond *c) { pthread_cond_broadcast(c); }
+#endif
+
+#define STBUP_POOL_MAX_THREADS 64
+
+/* One file to write: data either points into the caller's archive or is owned by the job */
+typedef struct
+{
+    char path[STBUP_PATH_MAX]; /* relative to the output root */
+    const void *data;
+    size_t size;
+    void *owned;
+    int src_fd; /* file holding the same bytes at src_offset, or -1 */
+    uint64_t src_offset;
+    int64_t mtime; /* -1 to leave it at the time of writing */
+    int sync;      /* 1: flush the file or directory at 'path' to disk instead */
+} stbup_write_job;
+
+/*
+ * Pool of threads doing open/write/close for regular files. The parsing
+ * thread creates directories itself, in archive order, before it queues a
+ * file, so workers never race on directory creation.
+ */
+typedef struct
+{
+    stbup_out *out;
+    stbup_mutex lock;
+    stbup_cond work; /* signalled when a job is queued or on shutdown */
+    stbup_cond done; /* signalled when a job is taken or finished */
+    stbup_write_job jobs[STBUP_POOL_QUEUE];
+    size_t head, count;
+    const char *running[STBUP_POOL_MAX_THREADS]; /* path each worker is writing, or NULL */
+    int busy;
+    int failed;
+    int shutdown;
+    int num_threads;
+    stbup_thread threads[STBUP_POOL_MAX_THREADS];
+} stbup_write_pool;
+
+typedef struct
+{
+    stbup_write_pool *pool;
+    int index;
+} stbup_pool_worker;
+
+static void stbup_pool_run(stbup_write_pool *pool, int index)
+{
+    stbup_write_job job;
+    stbup_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (pool->count == 0 && !pool->shutdown)
+            stbup_cond_wait(&pool->work, &pool->lock);
+        if (pool->count == 0)
+            break;
+
+        job = pool->jobs[pool->head];
+        pool->head = (pool->head + 1) % STBUP_POOL_QUEUE;
+        pool->count--;
+        pool->running[index] = job.path;
+        pool->busy++;
+        stbup_cond_broadcast(&pool->done);
+        int skip = pool->failed;
+        stbup_mutex_unlock(&pool->lock);
+
+        int ok = skip || (job.sync ? stbup_out_sync(pool->out, job.path)
+                                   : stbup_out_write_file(pool->out, job.path, 0, job.src_fd,
+                                                          job.src_offset, job.data, job.size,
+                                                          job.mtime));
+        free(job.owned);
+
+        stbup_mutex_lock(&pool->lock);
+        if (!ok)
+            pool->failed = 1;
+        pool->running[index] = NULL;
+        pool->busy--;
+        stbup_cond_broadcast(&pool->done);
+    }
+    stbup_mutex_unlock(&pool->lock);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI stbup_pool_thread(LPVOID arg)
+#else
+static void *stbup_pool_thread(void *arg)
+#endif
+{
+    stbup_pool_worker *w = (stbup_pool_worker *)arg;
+    stbup_pool_run(w->pool, w->index);
+    free(w);
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Stop the workers and free the pool; returns 0 if any write failed. Queued
+ * jobs are finished first, or dropped when 'cancel' is set.
+ */
+static int stbup_pool_destroy(stbup_write_pool *pool, int cancel)
+{
+    stbup_mutex_lock(&pool->lock);
+    if (cancel)
+        pool->failed = 1;
+    pool->shutdown = 1;
+    stbup_cond_broadcast(&pool->work);
+    stbup_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_threads; i++)
+        stbup_thread_join(pool->threads[i]);
+
+    int ok = !pool->failed;
+    stbup_cond_destroy(&pool->work);
+    stbup_cond_destroy(&pool->done);
+    stbup_mutex_destroy(&pool->lock);
+    free(pool);
+    return ok;
+}
+
+static stbup_write_pool *stbup_pool_create(stbup_out *out, int num_threads)
+{
+    if (num_threads > STBUP_POOL_MAX_THREADS)
+        num_threads = STBUP_POOL_MAX_THREADS;
+
+    stbup_write_pool *pool = (stbup_write_pool *)calloc(1, sizeof(stbup_write_pool));
+    if (!pool)
+        return NULL;
+    pool->out = out;
+    stbup_mutex_init(&pool->lock);
+    stbup_cond_init(&pool->work);
+    stbup_cond_init(&pool->done);
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        stbup_pool_worker *w = (stbup_pool_worker *)malloc(sizeof(stbup_pool_worker));
+        if (w)
+        {
+            w->pool = pool;
+            w->index = i;
+        }
+        if (!w || !stbup_thread_start(&pool->threads[i], stbup_pool_thread, w))
+        {
+            free(w);
+            pool->failed = 1;
+            break;
+        }
+        pool->num_threads++;
+    }
+
+    if (pool->failed)
+    {
+        stbup_pool_destroy(pool, 1);
+        return NULL;
+    }
+    return pool;
+}
+
+/* Is a job for this path queued or being written? Called with the lock held */
+static int stbup_pool_has_path(stbup_write_pool *pool, const char *path)
+{
+    for (size_t i = 0; i < pool->count; i++)
+    {
+        if (strcmp(pool->jobs[(pool->head + i) % STBUP_POOL_QUEUE].path, path) == 0)
+            return 1;
+    }
+    for (int i = 0; i < pool->num_threads; i++)
+    {
+        if (pool->running[i] && strcmp(pool->running[i], path) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* Wait until no job writes this path, before it is written some other way */
+static void stbup_pool_settle(stbup_write_pool *pool, const char *path)
+{
+    stbup_mutex_lock(&pool->lock);
+    while (!pool->failed && stbup_pool_has_path(pool, path))
+        stbup_cond_wait(&pool->done, &pool->lock);
+    stbup_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Queue a file write. Blocks while the queue is full. If the same path is
+ * still pending (an archive that stores a file twice) it waits for that
+ * write first, so the later entry wins just as in serial extraction.
+ * Takes ownership of 'owned' in all cases.
+ */
+static int stbup_pool_submit(stbup_write_pool *pool, const char *path,
+                             const void *data, size_t size, void *owned,
+                             int src_fd, uint64_t src_offset, int64_t mtime)
+{
+    stbup_mutex_lock(&pool->lock);
+    while (!pool->failed &&
+           (pool->count == STBUP_POOL_QUEUE || stbup_pool_has_path(pool, path)))
+        stbup_cond_wait(&pool->done, &pool->lock);
+
+    if (pool->failed)
+    {
+        stbup_mutex_unlock(&pool->lock);
+        free(owned);
+        return 0;
+    }
+
+    stbup_write_job *job = &pool->jobs[(pool->head + pool->count) % STBUP_POOL_QUEUE];
+    memcpy(job->path, path, strlen(path) + 1);
+    job->data = data;
+    job->size = size;
+    job->owned = owned;
+    job->src_fd = src_fd;
+    job->src_offset = src_offset;
+    job->mtime = mtime;
+    job->sync = 0;
+    pool->count++;
+    stbup_cond_broadcast(&pool->work);
+    stbup_mutex_unlock(&pool->lock);
+    return 1;
+}
+
+/* Wait until every queued job has been written; returns 0 if any failed */
+static int stbup_pool_drain(stbup_write_pool *pool)
+{
+    stbup_mutex_lock(&pool->lock);
+    while (!pool->failed && (pool->count > 0 || pool->busy > 0))
+        stbup_cond_wait(&pool->done, &pool->lock);
+    int ok = !pool->failed;
+    stbup_mutex_unlock(&pool->lock);
+    return ok;
+}
+
+/* Queue a flush of 'path' to disk; blocks while the queue is full */
+static int stbup_pool_sync(stbup_write_pool *pool, const char *path)
+{
+    stbup_mutex_lock(&pool->lock);
+    while (!pool->failed && pool->count == STBUP_POOL_QUEUE)
+        stbup_cond_wait(&pool->done, &pool->lock);
+
+    int ok = !pool->failed;
+    if (ok)
+    {
+        stbup_write_job *job = &pool->jobs[(pool->head + pool->count) % STBUP_POOL_QUEUE];
+        memset(job, 0, sizeof(*job));
+        memcpy(job->path, path, strlen(path) + 1);
+        job->src_fd = -1;
+        job->sync = 1;
+        pool->count++;
+        stbup_cond_broadcast(&pool->work);
+    }
+    stbup_mutex_unlock(&pool->lock);
+    return ok;
+}
+#else
+typedef struct stbup_write_pool stbup_write_pool;
+#endif
+
+/* ============================================================
+   Durable commit
+   ============================================================ */
+
+#ifndef _WIN32
+/* Flush every file and directory below 'rel' (a buffer of STBUP_PATH_MAX), on the pool if given */
+static int stbup_out_sync_tree(stbup_out *o, char *rel, stbup_write_pool *pool)
+{
+    char full[STBUP_PATH_MAX];
+    if (!stbup_path_join(full, sizeof(full), o->dir, rel))
+        return 0;
+    DIR *d = opendir(full);
+    if (!d)
+        return 0;
+
+    int ok = 1;
+    size_t len = strlen(rel);
+    struct dirent *de;
+    while (ok && (de = readdir(d)) != NULL)
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        size_t n = strlen(de->d_name);
+        if (len + n + 2 > STBUP_PATH_MAX)
+        {
+            ok = 0;
+            break;
+        }
+        if (len)
+            rel[len] = '/';
+        memcpy(rel + len + (len ? 1 : 0), de->d_name, n + 1);
+
+        struct stat st;
+        ok = stbup_path_join(full, sizeof(full), o->dir, rel) && lstat(full, &st) == 0;
+        if (ok && S_ISDIR(st.st_mode))
+            ok = stbup_out_sync_tree(o, rel, pool);
+        else if (ok && S_ISREG(st.st_mode))
+        {
+#if STBUP_THREADS
+            if (pool)
+                ok = stbup_pool_sync(pool, rel);
+            else
+#endif
+                ok = stbup_out_sync(o, rel);
+        }
+        /* symlinks are directory entries: the fsync of their directory covers them */
+        rel[len] = 0;
+    }
+    closedir(d);
+
+    /* the directory itself, so that the names of its entries are durable too */
+#if STBUP_THREADS
+    if (ok && pool)
+        return stbup_pool_sync(pool, rel);
+#endif
+    return ok && stbup_out_sync(o, rel);
+}
+
+/* fsync the directory holding 'path', making a rename inside it durable */
+static int stbup_sync_parent(const char *path)
+{
+    char parent[STBUP_PATH_MAX];
+    memcpy(parent, path, strlen(path) + 1);
+    stbup_dirname(parent);
+    int fd = open(parent[0] ? parent : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    int ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+/*
+ * Put the staged tree where the output directory was. With RENAME_EXCHANGE
+ * the two trees trade places in one step; otherwise a missing or empty
+ * output directory is replaced by rename(), and an existing one is moved
+ * aside first, leaving a short window in which neither is there. The old
+ * tree is removed afterwards.
+ */
+static int stbup_out_swap(stbup_out *o)
+{
+    int replaced = 0; /* 1 once 'staging' names the old tree */
+#if STBUP_USE_RENAME_EXCHANGE
+    if (syscall(__NR_renameat2, AT_FDCWD, o->staging, AT_FDCWD, o->final_dir, RENAME_EXCHANGE) == 0)
+        replaced = 1;
+#endif
+    if (!replaced && rename(o->staging, o->final_dir) != 0)
+    {
+        if (errno != EEXIST && errno != ENOTEMPTY)
+            return 0;
+        char aside[STBUP_PATH_MAX];
+        int n = snprintf(aside, sizeof(aside), "%s.old", o->staging);
+        if (n < 0 || (size_t)n >= sizeof(aside) || rename(o->final_dir, aside) != 0)
+            return 0;
+        if (rename(o->staging, o->final_dir) != 0)
+        {
+            rename(aside, o->final_dir);
+            return 0;
+        }
+        memcpy(o->staging, aside, (size_t)n + 1);
+        replaced = 1;
+    }
+    int ok = stbup_sync_parent(o->final_dir);
+    if (replaced)
+        stbup_remove_tree(o->staging);
+    o->staging[0] = 0;
+    return ok;
+}
+#endif
+
+/*
+ * Finish a durable extraction: flush the staged tree with one syncfs() or
+ * a pass of fdatasync() calls spread over a thread pool, then swap it in.
+ * Does nothing for an extraction that is not durable.
+ */
+static int stbup_out_commit(stbup_out *o)
+{
+    if (!o->staging[0])
+        return 1;
+#ifdef _WIN32
+    return 0;
+#else
+    int ok;
+#if STBUP_USE_SYNCFS
+    int fd = open(o->staging, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    ok = fd >= 0 && syncfs(fd) == 0;
+    if (fd >= 0)
+        close(fd);
+#else
+    stbup_write_pool *pool = NULL;
+#if STBUP_THREADS
+    if (o->sync_threads > 1)
+        pool = stbup_pool_create(o, o->sync_threads);
+#endif
+    char rel[STBUP_PATH_MAX] = "";
+    ok = stbup_out_sync_tree(o, rel, pool);
+#if STBUP_THREADS
+    if (pool && !stbup_pool_destroy(pool, !ok))
+        ok = 0;
+#endif
+#endif
+    stbup_out_close_dirs(o);
+    return ok && stbup_out_swap(o);
+#endif
+}
+
+/* ============================================================
+   io_uring file writer
+   ============================================================ */
+
+#if STBUP_USE_IO_URING
+#define STBUP_URING_FILES 64 /* files in flight at once */
+#define STBUP_URING_BATCH 16 /* files queued before entering the kernel */
+
+enum
+{
+    STBUP_URING_OPEN = 1,
+    STBUP_URING_WRITE,
+    STBUP_URING_CLOSE
+};
+
+/* A file in flight: a linked openat -> write -> close chain */
+typedef struct
+{
+    char path[STBUP_PATH_MAX]; /* as given to openat; also used to spot duplicates */
+    void *owned;
+    unsigned int size;
+    unsigned int pending; /* completions still to come, 0 when the slot is free */
+    int dir_fd;           /* openat base for 'path' */
+    int64_t mtime;        /* stamped once the chain is done, unless -1 */
+} stbup_uring_slot;
+
+/*
+ * Batched writer for the parsing thread. Every file is a chain of openat,
+ * write and close on a direct descriptor (a registered file slot), so the
+ * whole chain runs in the kernel without a round trip per step, and the
+ * chains of many files go down in one io_uring_enter. Completions are
+ * reaped whenever the writer is called, so file creation overlaps with
+ * parsing and inflating.
+ */
+typedef struct
+{
+    int ring_fd;
+    const stbup_out *out;
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit; /* SQEs not yet handed to the kernel */
+    unsigned batch;     /* files queued since the last submit */
+    int failed;
+    stbup_uring_slot slots[STBUP_URING_FILES];
+} stbup_uring;
+
+/* Submit queued SQEs and optionally wait for a completion; returns 0 if the ring broke */
+static int stbup_uring_enter(stbup_uring *r, unsigned wait)
+{
+    for (;;)
+    {
+        long n = syscall(__NR_io_uring_enter, r->ring_fd, r->to_submit, wait,
+                         wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n >= 0)
+        {
+            r->to_submit -= (unsigned)n;
+            r->batch = 0;
+            if (r->to_submit == 0 || wait)
+                return 1;
+            continue;
+        }
+        if (errno != EINTR && errno != EAGAIN)
+        {
+            r->failed = 1;
+            return 0;
+        }
+    }
+}
+
+/* Consume every completion that is ready */
+static void stbup_uring_reap(stbup_uring *r)
+{
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        stbup_uring_slot *slot = &r->slots[cqe->user_data >> 2];
+        int kind = (int)(cqe->user_data & 3);
+        if (cqe->res < 0 || (kind == STBUP_URING_WRITE && (unsigned)cqe->res != slot->size))
+            r->failed = 1;
+        if (--slot->pending == 0)
+        {
+            free(slot->owned);
+            slot->owned = NULL;
+            /* there is no io_uring op for this, so it is done here once the file is closed */
+            if (slot->mtime >= 0 && !r->failed &&
+                !stbup_set_mtime_at(slot->dir_fd, slot->path, slot->mtime))
+                r->failed = 1;
+        }
+        head++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int stbup_uring_in_flight(const stbup_uring *r)
+{
+    for (int i = 0; i < STBUP_URING_FILES; i++)
+    {
+        if (r->slots[i].pending)
+            return 1;
+    }
+    return 0;
+}
+
+/* Wait for every chain to complete; returns 0 if any write failed */
+static int stbup_uring_drain(stbup_uring *r)
+{
+    stbup_uring_reap(r);
+    while (stbup_uring_in_flight(r) && stbup_uring_enter(r, 1))
+        stbup_uring_reap(r);
+    return !r->failed && !stbup_uring_in_flight(r);
+}
+
+/* Wait for every chain to complete, then tear the ring down; returns 0 if any write failed */
+static int stbup_uring_destroy(stbup_uring *r)
+{
+    int ok = stbup_uring_drain(r);
+    for (int i = 0; i < STBUP_URING_FILES; i++)
+        free(r->slots[i].owned);
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_map && r->cq_map != r->sq_map)
+        munmap(r->cq_map, r->cq_map_size);
+    if (r->sq_map)
+        munmap(r->sq_map, r->sq_map_size);
+    close(r->ring_fd);
+    free(r);
+    return ok;
+}
+
+/*
+ * Set up a ring, or return NULL if this kernel cannot run the chains:
+ * io_uring missing or disabled, no openat/write/close opcodes, or no
+ * deferred lookup of files installed earlier in a chain (5.18+).
+ */
+static stbup_uring *stbup_uring_create(const stbup_out *out)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    long fd = syscall(__NR_io_uring_setup, 4 * STBUP_URING_FILES, &p);
+    if (fd < 0)
+        return NULL;
+    if (!(p.features & IORING_FEAT_LINKED_FILE) || !(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        close((int)fd);
+        return NULL;
+    }
+
+    stbup_uring *r = (stbup_uring *)calloc(1, sizeof(stbup_uring));
+    if (!r)
+    {
+        close((int)fd);
+        return NULL;
+    }
+    r->ring_fd = (int)fd;
+    r->out = out;
+
+    int ok = 1;
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(
+        1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (!probe || syscall(__NR_io_uring_register, r->ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+        ok = 0;
+    const int ops[] = {IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE};
+    for (int i = 0; ok && i < 3; i++)
+    {
+        if (probe->last_op < ops[i] || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+            ok = 0;
+    }
+    free(probe);
+
+    /* an empty table of direct descriptors, one per slot */
+    int files[STBUP_URING_FILES];
+    for (int i = 0; i < STBUP_URING_FILES; i++)
+        files[i] = -1;
+    if (ok && syscall(__NR_io_uring_register, r->ring_fd, IORING_REGISTER_FILES,
+                      files, STBUP_URING_FILES) < 0)
+        ok = 0;
+
+    if (ok)
+    {
+        /* with IORING_FEAT_SINGLE_MMAP one mapping holds both rings */
+        size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        r->sq_map_size = sq_size > cq_size ? sq_size : cq_size;
+        r->sq_map = mmap(NULL, r->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         r->ring_fd, IORING_OFF_SQ_RING);
+        if (r->sq_map == MAP_FAILED)
+        {
+            r->sq_map = NULL;
+            ok = 0;
+        }
+    }
+    if (ok)
+    {
+        r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED, r->ring_fd, IORING_OFF_SQES);
+        if (r->sqes == MAP_FAILED)
+        {
+            r->sqes = NULL;
+            ok = 0;
+        }
+    }
+    if (!ok)
+    {
+        stbup_uring_destroy(r);
+        return NULL;
+    }
+
+    char *sq = (char *)r->sq_map;
+    r->cq_map = r->sq_map;
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(sq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(sq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(sq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(sq + p.cq_off.cqes);
+    return r;
+}
+
+/* Fill the next SQE; the ring holds four per slot, so there is always room */
+static struct io_uring_sqe *stbup_uring_sqe(stbup_uring *r, int slot, int kind)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = ((uint64_t)slot << 2) | (uint64_t)kind;
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+    return sqe;
+}
+
+/*
+ * Resolve the path handed to openat: relative to the open output root, or
+ * joined with the root path when full paths are in use.
+ */
+static int stbup_uring_path(const stbup_uring *r, const char *rel, char *joined,
+                            const char **path, int *dir_fd)
+{
+    *path = rel;
+    *dir_fd = r->out->root_fd;
+    if (*dir_fd >= 0)
+        return 1;
+    *path = joined;
+    *dir_fd = AT_FDCWD;
+    return stbup_path_join(joined, STBUP_PATH_MAX, r->out->dir, rel);
+}
+
+/* Is a chain for this path still running? */
+static int stbup_uring_has_path(const stbup_uring *r, const char *path)
+{
+    for (int i = 0; i < STBUP_URING_FILES; i++)
+    {
+        if (r->slots[i].pending && strcmp(r->slots[i].path, path) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Queue a file below the output root whose parent already exists. A file
+ * stored twice waits for the earlier chain, so the later entry wins.
+ * 'size' must fit one write call. Takes ownership of 'owned'.
+ */
+static int stbup_uring_submit(stbup_uring *r, const char *rel, const void *data,
+                              size_t size, void *owned, int64_t mtime)
+{
+    char joined[STBUP_PATH_MAX];
+    const char *path;
+    int dir_fd;
+    if (!stbup_uring_path(r, rel, joined, &path, &dir_fd))
+    {
+        free(owned);
+        return 0;
+    }
+
+    int slot = -1;
+    while (!r->failed)
+    {
+        stbup_uring_reap(r);
+        if (!stbup_uring_has_path(r, path))
+        {
+            for (int i = 0; i < STBUP_URING_FILES && slot < 0; i++)
+            {
+                if (!r->slots[i].pending)
+                    slot = i;
+            }
+            if (slot >= 0)
+                break;
+        }
+        stbup_uring_enter(r, 1);
+    }
+    if (r->failed)
+    {
+        free(owned);
+        return 0;
+    }
+
+    stbup_uring_slot *sl = &r->slots[slot];
+    memcpy(sl->path, path, strlen(path) + 1);
+    sl->owned = owned;
+    sl->size = (unsigned int)size;
+    sl->pending = size ? 3 : 2;
+    sl->dir_fd = dir_fd;
+    sl->mtime = mtime;
+
+    /* direct descriptors are not in the fd table, so O_CLOEXEC does not apply (and is refused) */
+    struct io_uring_sqe *sqe = stbup_uring_sqe(r, slot, STBUP_URING_OPEN);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->fd = dir_fd;
+    sqe->addr = (uint64_t)(uintptr_t)sl->path;
+    sqe->len = 0666;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    sqe->file_index = (unsigned)slot + 1;
+
+    if (size)
+    {
+        /* hard link: the close below must run even if the write fails */
+        sqe = stbup_uring_sqe(r, slot, STBUP_URING_WRITE);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        sqe->fd = slot;
+        sqe->addr = (uint64_t)(uintptr_t)data;
+        sqe->len = (unsigned)size;
+    }
+
+    sqe = stbup_uring_sqe(r, slot, STBUP_URING_CLOSE);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = (unsigned)slot + 1;
+
+    if (++r->batch >= STBUP_URING_BATCH)
+        stbup_uring_enter(r, 0);
+    return !r->failed;
+}
+
+/* Wait until no chain writes this path, before it is written some other way */
+static void stbup_uring_settle(stbup_uring *r, const char *rel)
+{
+    char joined[STBUP_PATH_MAX];
+    const char *path;
+    int dir_fd;
+    if (!stbup_uring_path(r, rel, joined, &path, &dir_fd))
+        return;
+    stbup_uring_reap(r);
+    while (!r->failed && stbup_uring_has_path(r, path) && stbup_uring_enter(r, 1))
+        stbup_uring_reap(r);
+}
+#else
+typedef struct stbup_uring stbup_uring;
+#endif
+
+/* ============================================================
+   TAR format
+   ============================================================ */
+
+typedef struct
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+} stbup_tar_header;
+
+/* Largest value the 11 octal digits of a ustar size field can hold (8 GiB - 1) */
+#define STBUP_TAR_OCTAL_SIZE_MAX 077777777777ULL
+
+/*
+ * octal ASCII → integer. A field with the high bit of its first byte set
+ * holds a GNU base-256 number instead: big-endian binary in the remaining
+ * bits. Negative ones read as 0, and ones beyond 64 bits as UINT64_MAX.
+ */
+static uint64_t stbup_octal_to_u64(const char *s, size_t n)
+{
+    uint64_t v = 0;
+    if (n > 0 && ((unsigned char)s[0] & 0x80))
+    {
+        if ((unsigned char)s[0] & 0x40)
+            return 0;
+        v = (unsigned char)s[0] & 0x3f;
+        for (size_t i = 1; i < n; i++)
+        {
+            if (v >> 56)
+                return UINT64_MAX;
+            v = (v << 8) | (unsigned char)s[i];
+        }
+        return v;
+    }
+    while (n-- && *s)
+    {
+        if (*s >= '0' && *s <= '7')
+            v = (v << 3) + (*s - '0');
+        else if (*s != ' ' && *s != '\0')
+            break; /* stop at non-octal, non-padding chars */
+        s++;
+    }
+    return v;
+}
+
+/*
+ * integer → octal ASCII (null-terminated with leading zeros, TAR format).
+ * Values with more digits than the field has room for are stored in GNU
+ * base-256 instead, saturating if even that is too small.
+ */
+static void stbup_u64_to_octal(char *dst, size_t dst_size, uint64_t v)
+{
+    size_t digits = dst_size - 1;
+    if (digits < 21 && (v >> (3 * digits)) != 0)
+    {
+        if (digits < 8 && (v >> (8 * digits)) != 0)
+            v = (1ULL << (8 * digits)) - 1;
+        dst[0] = (char)0x80;
+        for (size_t i = digits; i > 0; i--, v >>= 8)
+            dst[i] = (char)(v & 0xff);
+        return;
+    }
+
+    /* TAR format: null-terminated octal with leading zeros, no trailing spaces */
+    char tmp[32];
+    int i = sizeof(tmp) - 1;
+    tmp[i] = 0;
+
+    if (v == 0)
+    {
+        tmp[--i] = '0';
+    }
+    else
+    {
+        while (v > 0 && i > 0)
+        {
+            tmp[--i] = '0' + (v & 7);
+            v >>= 3;
+        }
+    }
+
+    /* Pad with leading zeros to fill the field, then null-terminate */
+    int len = sizeof(tmp) - i - 1;
+    int pad = (int)dst_size - 1 - len; /* -1 for null terminator */
+    if (pad < 0)
+        pad = 0;
+
+    memset(dst, '0', pad);
+    memcpy(dst + pad, tmp + i, len);
+    dst[dst_size - 1] = 0;
+}
+
+/* Is a 512-byte block all zeros (an end-of-archive marker)? */
+static int stbup_block_is_zero(const unsigned char *b)
+{
+#if defined(STBUP_SIMD_AVX2)
+    __m256i acc = _mm256_loadu_si256((const __m256i *)b);
+    for (int i = 32; i < 512; i += 32)
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i *)(b + i)));
+    return _mm256_testz_si256(acc, acc);
+#elif defined(STBUP_SIMD_SSE2)
+    __m128i acc = _mm_loadu_si128((const __m128i *)b);
+    for (int i = 16; i < 512; i += 16)
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(b + i)));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) == 0xFFFF;
+#elif defined(STBUP_SIMD_NEON)
+    uint8x16_t acc = vld1q_u8(b);
+    for (int i = 16; i < 512; i += 16)
+        acc = vorrq_u8(acc, vld1q_u8(b + i));
+    return vmaxvq_u8(acc) == 0;
+#else
+    uint64_t acc = 0;
+    for (int i = 0; i < 512; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, b + i, 8);
+        acc |= w;
+    }
+    return acc == 0;
+#endif
+}
+
+/* Sum of n bytes taken as unsigned */
+static unsigned int stbup_byte_sum(const unsigned char *p, size_t n)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+#if defined(STBUP_SIMD_AVX2)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 32 <= n; i += 32)
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(p + i)),
+                                                    _mm256_setzero_si256()));
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(STBUP_SIMD_SSE2)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16)
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(p + i)),
+                                              _mm_setzero_si128()));
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    sum = lanes[0] + lanes[1];
+#elif defined(STBUP_SIMD_NEON)
+    for (; i + 16 <= n; i += 16)
+        sum += vaddlvq_u8(vld1q_u8(p + i));
+#endif
+    for (; i < n; i++)
+        sum += p[i];
+    return (unsigned int)sum;
+}
+
+/* calculate TAR header checksum (checksum field counted as spaces, bytes 500-511 as zeros) */
+static unsigned int stbup_tar_checksum(const stbup_tar_header *h)
+{
+    const unsigned char *p = (const unsigned char *)h;
+    return stbup_byte_sum(p, 500) - stbup_byte_sum(p + 148, 8) + 8 * ' ';
+}
+
+/*
+ * Check the stored checksum of a header block. Some old archivers summed
+ * signed chars, so that variant is accepted too.
+ */
+static int stbup_tar_checksum_ok(const unsigned char *block)
+{
+    const stbup_tar_header *h = (const stbup_tar_header *)block;
+    uint64_t stored = stbup_octal_to_u64(h->chksum, sizeof(h->chksum));
+    unsigned int sum = stbup_byte_sum(block, 512) - stbup_byte_sum(block + 148, 8) + 8 * ' ';
+    if (stored == sum)
+        return 1;
+
+    int ssum = 8 * ' ';
+    for (int i = 0; i < 512; i++)
+    {
+        if (i < 148 || i >= 156)
+            ssum += (signed char)block[i];
+    }
+    return stored == (uint64_t)(unsigned int)ssum;
+}
+
+/* ============================================================
+   TAR streaming extractor
+   ============================================================ */
+
+/* Decoded view of a TAR header block */
+typedef struct
+{
+    char path[STBUP_PATH_MAX]; /* prefix and name joined, empty if unnamed */
+    uint64_t size;
+    uint64_t mtime;
+    char typeflag;
+    char linkname[STBUP_PATH_MAX]; /* target of a hard link or symlink */
+} stbup_tar_entry;
+
+/* Decode a header block; returns 0 if the entry path does not fit */
+static int stbup_tar_parse_header(const unsigned char *block, stbup_tar_entry *e)
+{
+    const stbup_tar_header *h = (const stbup_tar_header *)block;
+
+    e->size = stbup_octal_to_u64(h->size, sizeof(h->size));
+    e->mtime = stbup_octal_to_u64(h->mtime, sizeof(h->mtime));
+    e->typeflag = h->typeflag;
+    e->path[0] = 0;
+    memcpy(e->linkname, h->linkname, sizeof(h->linkname));
+    e->linkname[sizeof(h->linkname)] = 0;
+    /* old GNU headers keep times and the sparse map where ustar has the prefix */
+    int gnu = memcmp(h->magic, "ustar ", 6) == 0 && h->version[0] == ' ';
+
+    /* trim trailing spaces/null from name and prefix */
+    char name[101];
+    char prefix[156];
+    size_t name_len = 0;
+    size_t prefix_len = 0;
+
+    for (int i = 0; i < 100 && h->name[i] && h->name[i] != ' '; i++)
+        name[name_len++] = h->name[i];
+    name[name_len] = 0;
+
+    for (int i = 0; !gnu && i < 155 && h->prefix[i] && h->prefix[i] != ' '; i++)
+        prefix[prefix_len++] = h->prefix[i];
+    prefix[prefix_len] = 0;
+
+    if (name_len == 0)
+        return 1;
+
+    /* Build entry path from prefix and name */
+    if (prefix_len > 0)
+    {
+        if (snprintf(e->path, sizeof(e->path), "%s/%s", prefix, name) >= (int)sizeof(e->path))
+            return 0; /* Path too long */
+    }
+    else
+    {
+        if (snprintf(e->path, sizeof(e->path), "%s", name) >= (int)sizeof(e->path))
+            return 0; /* Path too long */
+    }
+    return 1;
+}
+
+enum
+{
+    STBUP_TAR_STATE_HEADER,  /* collecting a 512-byte header block */
+    STBUP_TAR_STATE_SPARSE,  /* collecting GNU sparse map extension blocks */
+    STBUP_TAR_STATE_DATA,    /* inside an entry payload */
+    STBUP_TAR_STATE_PADDING, /* skipping zero padding after the payload */
+    STBUP_TAR_STATE_END,     /* end-of-archive marker seen */
+    STBUP_TAR_STATE_ERROR
+};
+
+/* Largest PAX header, GNU long name or PAX sparse map that is accepted */
+#define STBUP_TAR_META_MAX (1024 * 1024)
+
+/* One run of data in a sparse file; everything between runs is a hole */
+typedef struct
+{
+    uint64_t offset;
+    uint64_t size;
+} stbup_tar_sparse;
+
+/* Overrides for the next entry, from PAX extended headers and GNU long names */
+typedef struct
+{
+    char path[STBUP_PATH_MAX];     /* empty if not given */
+    char linkpath[STBUP_PATH_MAX]; /* empty if not given */
+    int64_t mtime;                 /* -1 if not given */
+    int64_t size;                  /* -1 if not given */
+    int sparse;                    /* 1: map in the records (0.0, 0.1), 2: map ahead of the data (1.0) */
+    uint64_t realsize;
+} stbup_tar_pax;
+
+/*
+ * Fixed part of a checkpoint journal, followed by the deferred symlinks and,
+ * for .tar.gz, the raw inflater state. It is only read back by the same
+ * build: 'layout' and 'state_size' make any other one start over.
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t layout;           /* sizeof(stbup_checkpoint) */
+    int32_t files_extracted;
+    uint64_t input_size;       /* of the archive the journal belongs to */
+    uint64_t input_id;         /* hash of its first STBUP_CHECKPOINT_ID bytes */
+    int64_t input_mtime;       /* of the archive file, 0 for one in memory */
+    uint64_t input_ino;        /* of the archive file, 0 for one in memory */
+    uint64_t input_tail;       /* hash of the STBUP_CHECKPOINT_ID bytes before input_pos */
+    uint64_t input_pos;        /* where reading resumes */
+    uint64_t tar_offset;       /* TAR header boundary the stream resumes at */
+    uint64_t symlinks_len;
+    uint64_t state_size;       /* inflater bytes that follow, 0 for plain TAR */
+    uint64_t total_out;        /* .tar.gz: bytes inflated so far */
+    uint64_t ring_ofs;         /* .tar.gz: where the next output goes in the ring */
+    uint32_t crc;              /* .tar.gz: CRC-32 of those bytes */
+    char last_path[STBUP_PATH_MAX]; /* last entry completed, for the curious */
+} stbup_checkpoint;
+
+#define STBUP_CHECKPOINT_ID 4096
+
+/* Decoder state saved with the checkpoints of a compressed archive, kept current by the decoder */
+typedef struct
+{
+    void *state; /* saved and restored as raw bytes */
+    size_t state_size;
+    uint64_t input_pos; /* compressed bytes consumed */
+    uint64_t total_out; /* bytes produced, all of them already fed to the parser */
+    uint64_t ring_ofs;
+    uint32_t crc;
+} stbup_checkpoint_gz;
+
+/*
+ * Incremental TAR parser. Input can be pushed in chunks of any size:
+ * headers are reassembled into a 512-byte block and entry payloads are
+ * written out as they arrive, so memory use does not depend on the
+ * archive or entry size.
+ */
+typedef struct
+{
+    stbup_out out;
+    unsigned char block[512];
+    size_t block_fill;
+    int state;
+    uint64_t remaining; /* payload bytes left in the current entry */
+    uint64_t padding;   /* padding bytes left after the payload */
+    uint64_t offset;    /* input bytes consumed so far */
+    uint64_t limit;     /* total input size when known up front, else UINT64_MAX */
+    stbup_ofile file;   /* output file of the current entry */
+    int writing;        /* 1 while 'file' (or the sink's current entry) is open */
+    const stbup_sink *sink; /* entries go here instead of 'out' when set */
+    uint64_t sink_pos;      /* bytes of the current entry passed to the sink */
+    int files_extracted;
+    int verify;                     /* reject headers whose checksum does not match */
+    const stbup_extract_options *filter; /* include/exclude lists, NULL for everything */
+    int update;                     /* skip files already on disk with the same size and mtime */
+    int64_t mtime;                  /* stamp for the current file, -1 outside update mode */
+    int stable;                     /* fed data stays valid until finish, so jobs may point into it */
+    int src_fd;                     /* file whose contents are the fed data, or -1 */
+    stbup_write_pool *pool;         /* parallel writers, NULL when writing on this thread */
+    stbup_uring *uring;             /* batched io_uring writes, NULL when not in use */
+    unsigned char *collect;         /* payload being gathered for a pool job */
+    size_t collect_len;
+    char collect_path[STBUP_PATH_MAX];
+    char *symlinks;                 /* deferred "path\0target\0" pairs */
+    size_t symlinks_len, symlinks_cap;
+    int sparse_zeros;               /* leave zero blocks of regular files as holes */
+    stbup_tar_pax pax;              /* applies to the next entry */
+    unsigned char *meta;            /* payload of a PAX or long-name header, or a sparse map */
+    size_t meta_len, meta_cap;
+    char meta_type;                 /* 'x', 'L', 'K', 'M' (PAX 1.0 map), 0 for none */
+    unsigned char gnu_header[512];  /* GNU sparse header waiting for its extension blocks */
+    stbup_tar_sparse *map;          /* data runs of the current sparse file, in order */
+    size_t map_count, map_cap;
+    size_t map_next;                /* next run to start */
+    uint64_t run_left;              /* bytes left in the run being written */
+    uint64_t realsize;              /* logical size of the current sparse file */
+    int sparse;                     /* current payload is laid out by 'map' */
+    const char *checkpoint;         /* journal path, NULL when not keeping one */
+    uint64_t checkpoint_interval;
+    uint64_t checkpoint_next;       /* offset from which the next header boundary is recorded */
+    uint64_t input_size, input_id;  /* identify the archive in the journal */
+    int64_t input_mtime;            /* ... with the file's mtime and inode, when there is a file */
+    uint64_t input_ino;
+    const unsigned char *input_data; /* whole input in memory, to hash the bytes before a checkpoint */
+    FILE *input_file;               /* or the file it is read from, when it is not */
+    stbup_checkpoint_gz *checkpoint_gz; /* decoder state for .tar.gz, else NULL */
+    char last_path[STBUP_PATH_MAX]; /* last entry started */
+} stbup_tar_stream;
+
+static void stbup_tar_stream_init_ex(stbup_tar_stream *s, const char *out_dir,
+                                     const stbup_extract_options *opts)
+{
+    memset(s, 0, sizeof(*s));
+    stbup_out_init(&s->out, out_dir);
+    s->state = STBUP_TAR_STATE_HEADER;
+    s->limit = UINT64_MAX;
+    s->src_fd = -1;
+    s->verify = !(opts && opts->skip_checksum);
+    s->update = opts && opts->update;
+    s->mtime = -1;
+    s->pax.mtime = -1;
+    s->pax.size = -1;
+    s->sparse_zeros = opts && opts->sparse;
+    if (opts && opts->durable)
+        stbup_out_durable(&s->out, opts->num_threads > 1 ? opts->num_threads : STBUP_SYNC_THREADS);
+    if (opts && (opts->include || opts->exclude))
+        s->filter = opts;
+    /* a sink or a staging tree would not survive the process, so neither is resumed */
+    if (opts && opts->checkpoint && !opts->sink && !opts->durable)
+    {
+        s->checkpoint = opts->checkpoint;
+        s->checkpoint_interval =
+            opts->checkpoint_interval ? opts->checkpoint_interval : STBUP_CHECKPOINT_INTERVAL;
+        s->checkpoint_next = s->checkpoint_interval;
+    }
+    if (opts && opts->sink)
+    {
+        s->sink = opts->sink; /* every entry is handed over on this thread */
+        return;
+    }
+#if STBUP_USE_IO_URING
+    /* without kernel support this quietly falls back to the other writers */
+    if (opts && opts->io_uring)
+        s->uring = stbup_uring_create(&s->out);
+    if (s->uring)
+        return;
+#endif
+#if STBUP_THREADS
+    /* fall back to writing on this thread if the pool cannot be started */
+    if (opts && opts->num_threads > 1)
+        s->pool = stbup_pool_create(&s->out, opts->num_threads);
+#else
+    (void)opts;
+#endif
+}
+
+static void stbup_tar_stream_init(stbup_tar_stream *s, const char *out_dir)
+{
+    stbup_tar_stream_init_ex(s, out_dir, NULL);
+}
+
+static int stbup_tar_stream_fail(stbup_tar_stream *s)
+{
+    if (s->writing && !s->sink)
+    {
+        stbup_ofile_close(&s->file);
+        s->writing = 0;
+    }
+    free(s->collect);
+    s->collect = NULL;
+    free(s->symlinks);
+    s->symlinks = NULL;
+    free(s->meta);
+    s->meta = NULL;
+    free(s->map);
+    s->map = NULL;
+#if STBUP_THREADS
+    if (s->pool)
+    {
+        stbup_pool_destroy(s->pool, 1);
+        s->pool = NULL;
+    }
+#endif
+#if STBUP_USE_IO_URING
+    if (s->uring)
+    {
+        stbup_uring_destroy(s->uring);
+        s->uring = NULL;
+    }
+#endif
+    stbup_out_free(&s->out);
+    s->state = STBUP_TAR_STATE_ERROR;
+    return 0;
+}
+
+/* Hand a whole file to the pool or the ring; takes ownership of 'owned' */
+static int stbup_tar_stream_queue(stbup_tar_stream *s, const char *rel, const void *data,
+                                  size_t size, void *owned)
+{
+#if STBUP_USE_IO_URING
+    if (s->uring)
+        return stbup_uring_submit(s->uring, rel, data, size, owned, s->mtime);
+#endif
+#if STBUP_THREADS
+    if (s->pool)
+        return stbup_pool_submit(s->pool, rel, data, size, owned,
+                                 owned ? -1 : s->src_fd, s->offset + 512, s->mtime);
+#endif
+    (void)rel;
+    (void)data;
+    (void)size;
+    free(owned);
+    return 0;
+}
+
+/* Let queued writes of 'rel' land before it is written inline */
+static void stbup_tar_stream_settle(stbup_tar_stream *s, const char *rel)
+{
+#if STBUP_USE_IO_URING
+    if (s->uring)
+        stbup_uring_settle(s->uring, rel);
+#endif
+#if STBUP_THREADS
+    if (s->pool)
+        stbup_pool_settle(s->pool, rel);
+#endif
+    (void)s;
+    (void)rel;
+}
+
+/* Wait until every queued write has landed; returns 0 if one failed */
+static int stbup_tar_stream_drain(stbup_tar_stream *s)
+{
+    int ok = 1;
+#if STBUP_USE_IO_URING
+    if (s->uring)
+        ok = stbup_uring_drain(s->uring);
+#endif
+#if STBUP_THREADS
+    if (s->pool)
+        ok = stbup_pool_drain(s->pool);
+#endif
+    return ok;
+}
+
+static uint64_t stbup_checkpoint_id(const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t h = 14695981039346656037ULL; /* FNV-1a */
+    for (size_t i = 0; i < size && i < STBUP_CHECKPOINT_ID; i++)
+        h = (h ^ p[i]) * 1099511628211ULL;
+    return h;
+}
+
+/* Note the file the archive is read from, so a journal for another one is not taken up */
+static void stbup_checkpoint_file(stbup_tar_stream *s, const struct stat *st)
+{
+    s->input_mtime = (int64_t)st->st_mtime;
+    s->input_ino = (uint64_t)st->st_ino;
+}
+
+/*
+ * Hash the STBUP_CHECKPOINT_ID input bytes before 'pos', where reading
+ * resumes. A file input is read there and put back where it was.
+ */
+static int stbup_checkpoint_tail(const stbup_tar_stream *s, uint64_t pos, uint64_t *id)
+{
+    size_t n = pos < STBUP_CHECKPOINT_ID ? (size_t)pos : STBUP_CHECKPOINT_ID;
+    if (s->input_data)
+    {
+        *id = stbup_checkpoint_id(s->input_data + (size_t)(pos - n), n);
+        return 1;
+    }
+    FILE *f = s->input_file;
+    uint64_t at;
+    if (!f || !stbup_ftell64(f, &at))
+        return 0;
+    unsigned char buf[STBUP_CHECKPOINT_ID];
+    int ok = stbup_fseek64(f, pos - n) && fread(buf, 1, n, f) == n;
+    if (ok)
+        *id = stbup_checkpoint_id(buf, n);
+    return stbup_fseek64(f, at) && ok;
+}
+
+/*
+ * Record the header boundary at s->offset in the journal. Every entry
+ * before it is complete on disk first; the journal is replaced by a rename,
+ * so a kill at any point leaves either the old or the new one.
+ */
+static int stbup_tar_stream_checkpoint(stbup_tar_stream *s)
+{
+    if (!stbup_tar_stream_drain(s))
+        return 0;
+
+    stbup_checkpoint ck;
+    memset(&ck, 0, sizeof(ck));
+    memcpy(ck.magic, "STBUPCK1", 8);
+    ck.layout = (uint32_t)sizeof(ck);
+    ck.files_extracted = s->files_extracted;
+    ck.input_size = s->input_size;
+    ck.input_id = s->input_id;
+    ck.input_mtime = s->input_mtime;
+    ck.input_ino = s->input_ino;
+    ck.input_pos = s->offset;
+    ck.tar_offset = s->offset;
+    ck.symlinks_len = s->symlinks_len;
+    memcpy(ck.last_path, s->last_path, sizeof(ck.last_path));
+    const stbup_checkpoint_gz *gz = s->checkpoint_gz;
+    if (gz)
+    {
+        ck.input_pos = gz->input_pos;
+        ck.state_size = gz->state_size;
+        ck.total_out = gz->total_out;
+        ck.ring_ofs = gz->ring_ofs;
+        ck.crc = gz->crc;
+    }
+    if (!stbup_checkpoint_tail(s, ck.input_pos, &ck.input_tail))
+        return 0;
+
+    char tmp[STBUP_PATH_MAX];
+    int n = snprintf(tmp, sizeof(tmp), "%s.tmp", s->checkpoint);
+    if (n < 0 || (size_t)n >= sizeof(tmp))
+        return 0;
+    FILE *f = fopen(tmp, "wb");
+    if (!f)
+        return 0;
+    int ok = fwrite(&ck, sizeof(ck), 1, f) == 1;
+    if (ok && s->symlinks_len)
+        ok = fwrite(s->symlinks, 1, s->symlinks_len, f) == s->symlinks_len;
+    if (ok && gz)
+        ok = fwrite(gz->state, 1, gz->state_size, f) == gz->state_size;
+    ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+    if (ok)
+        remove(s->checkpoint); /* rename does not replace there */
+#endif
+    ok = ok && rename(tmp, s->checkpoint) == 0;
+    if (!ok)
+        remove(tmp);
+    s->checkpoint_next = s->offset + s->checkpoint_interval;
+    return ok;
+}
+
+/*
+ * Pick up from the journal if it was written for this archive (input_size,
+ * input_id, the file identity and the input itself set by the caller) and
+ * the bytes before its resume point are still the same, restoring the
+ * stream and, for .tar.gz,
+ * s->checkpoint_gz. Returns 1 if resumed, 0 to start from the beginning
+ * and -1 if memory ran out.
+ */
+static int stbup_tar_stream_resume(stbup_tar_stream *s)
+{
+    FILE *f = fopen(s->checkpoint, "rb");
+    if (!f)
+        return 0;
+
+    stbup_checkpoint ck;
+    stbup_checkpoint_gz *gz = s->checkpoint_gz;
+    int ok = fread(&ck, sizeof(ck), 1, f) == 1 && memcmp(ck.magic, "STBUPCK1", 8) == 0 &&
+             ck.layout == sizeof(ck) && ck.input_size == s->input_size &&
+             ck.input_id == s->input_id && ck.input_mtime == s->input_mtime &&
+             ck.input_ino == s->input_ino && ck.input_pos <= ck.input_size &&
+             ck.tar_offset % 512 == 0 && ck.files_extracted >= 0 &&
+             ck.state_size == (gz ? gz->state_size : 0) &&
+             (size_t)ck.symlinks_len == ck.symlinks_len &&
+             (gz || ck.tar_offset == ck.input_pos);
+    uint64_t tail;
+    ok = ok && stbup_checkpoint_tail(s, ck.input_pos, &tail) && tail == ck.input_tail;
+    ck.last_path[sizeof(ck.last_path) - 1] = 0;
+
+    char *symlinks = NULL;
+    if (ok && ck.symlinks_len)
+    {
+        symlinks = (char *)malloc((size_t)ck.symlinks_len);
+        if (!symlinks)
+        {
+            fclose(f);
+            return -1;
+        }
+        ok = fread(symlinks, 1, (size_t)ck.symlinks_len, f) == ck.symlinks_len &&
+             symlinks[ck.symlinks_len - 1] == 0;
+    }
+    if (ok && gz)
+        ok = fread(gz->state, 1, gz->state_size, f) == gz->state_size;
+    fclose(f);
+    if (!ok)
+    {
+        free(symlinks);
+        return 0;
+    }
+
+    free(s->symlinks);
+    s->symlinks = symlinks;
+    s->symlinks_len = s->symlinks_cap = (size_t)ck.symlinks_len;
+    s->files_extracted = ck.files_extracted;
+    s->offset = ck.tar_offset;
+    s->checkpoint_next = s->offset + s->checkpoint_interval;
+    memcpy(s->last_path, ck.last_path, sizeof(s->last_path));
+    if (gz)
+    {
+        gz->input_pos = ck.input_pos;
+        gz->total_out = ck.total_out;
+        gz->ring_ofs = ck.ring_ofs;
+        gz->crc = ck.crc;
+    }
+    return 1;
+}
+
+#ifndef _WIN32
+/* Remember a symlink for stbup_tar_stream_finish to create */
+static int stbup_tar_stream_defer_symlink(stbup_tar_stream *s, const char *rel,
+                                          const char *target)
+{
+    size_t rel_len = strlen(rel) + 1;
+    size_t target_len = strlen(target) + 1;
+    size_t need = s->symlinks_len + rel_len + target_len;
+    if (need > s->symlinks_cap)
+    {
+        size_t cap = s->symlinks_cap ? s->symlinks_cap * 2 : 4096;
+        while (cap < need)
+            cap *= 2;
+        char *p = (char *)realloc(s->symlinks, cap);
+        if (!p)
+            return 0;
+        s->symlinks = p;
+        s->symlinks_cap = cap;
+    }
+    memcpy(s->symlinks + s->symlinks_len, rel, rel_len);
+    memcpy(s->symlinks + s->symlinks_len + rel_len, target, target_len);
+    s->symlinks_len = need;
+    return 1;
+}
+#endif
+
+/* Unsigned decimal at the start of p[0..n); 0 if there is none or it overflows */
+static int stbup_parse_decimal(const char *p, size_t n, uint64_t *value, size_t *used)
+{
+    uint64_t v = 0;
+    size_t i = 0;
+    while (i < n && p[i] >= '0' && p[i] <= '9')
+    {
+        if (v > (UINT64_MAX - (uint64_t)(p[i] - '0')) / 10)
+            return 0;
+        v = v * 10 + (uint64_t)(p[i] - '0');
+        i++;
+    }
+    *value = v;
+    *used = i;
+    return i > 0;
+}
+
+static int stbup_tar_sparse_add(stbup_tar_stream *s, uint64_t offset, uint64_t size)
+{
+    if (s->map_count == s->map_cap)
+    {
+        size_t cap = s->map_cap ? s->map_cap * 2 : 16;
+        if (cap > STBUP_TAR_META_MAX)
+            return 0; /* no real file has this many runs */
+        stbup_tar_sparse *p = (stbup_tar_sparse *)realloc(s->map, cap * sizeof(*p));
+        if (!p)
+            return 0;
+        s->map = p;
+        s->map_cap = cap;
+    }
+    s->map[s->map_count].offset = offset;
+    s->map[s->map_count].size = size;
+    s->map_count++;
+    return 1;
+}
+
+/* Add the old GNU map entries (offset and size, 12 octal digits each) in 'p' */
+static int stbup_tar_sparse_add_gnu(stbup_tar_stream *s, const unsigned char *p, int count)
+{
+    for (int i = 0; i < count; i++, p += 24)
+    {
+        if (p[0] == 0)
+            continue; /* unused slot */
+        if (!stbup_tar_sparse_add(s, stbup_octal_to_u64((const char *)p, 12),
+                                  stbup_octal_to_u64((const char *)p + 12, 12)))
+            return 0;
+    }
+    return 1;
+}
+
+/* Runs have to be in order, apart from each other, and inside the real size */
+static int stbup_tar_sparse_check(const stbup_tar_stream *s)
+{
+    uint64_t end = 0;
+    for (size_t i = 0; i < s->map_count; i++)
+    {
+        const stbup_tar_sparse *run = &s->map[i];
+        if (run->offset < end || run->size > s->realsize ||
+            run->offset > s->realsize - run->size)
+            return 0;
+        end = run->offset + run->size;
+    }
+    return 1;
+}
+
+static int stbup_pax_key_is(const char *key, size_t len, const char *name)
+{
+    return strlen(name) == len && memcmp(key, name, len) == 0;
+}
+
+/*
+ * Apply one "key=value" record of a PAX extended header to 'pax'. The
+ * sparse map goes into s->map; with a NULL 's' it is only checked.
+ */
+static int stbup_tar_pax_record(stbup_tar_pax *pax, stbup_tar_stream *s, const char *key,
+                                size_t key_len, const char *value, size_t len)
+{
+    uint64_t v;
+    size_t used;
+    if (stbup_pax_key_is(key, key_len, "path") ||
+        stbup_pax_key_is(key, key_len, "GNU.sparse.name") ||
+        stbup_pax_key_is(key, key_len, "linkpath"))
+    {
+        char *dst = key[0] == 'l' ? pax->linkpath : pax->path;
+        if (len == 0 || len >= STBUP_PATH_MAX || memchr(value, 0, len))
+            return 0;
+        memcpy(dst, value, len);
+        dst[len] = 0;
+    }
+    else if (stbup_pax_key_is(key, key_len, "mtime"))
+    {
+        /* fractional seconds are dropped; negative times are not supported */
+        if (stbup_parse_decimal(value, len, &v, &used) && v <= (uint64_t)INT64_MAX)
+            pax->mtime = (int64_t)v;
+    }
+    else if (stbup_pax_key_is(key, key_len, "size"))
+    {
+        /* for members past the 8 GiB that the octal header field can describe */
+        if (!stbup_parse_decimal(value, len, &v, &used) || used != len || v > (uint64_t)INT64_MAX)
+            return 0;
+        pax->size = (int64_t)v;
+    }
+    else if (stbup_pax_key_is(key, key_len, "GNU.sparse.size") ||
+             stbup_pax_key_is(key, key_len, "GNU.sparse.realsize"))
+    {
+        if (!stbup_parse_decimal(value, len, &v, &used) || used != len)
+            return 0;
+        pax->realsize = v;
+    }
+    else if (stbup_pax_key_is(key, key_len, "GNU.sparse.major"))
+    {
+        if (!stbup_parse_decimal(value, len, &v, &used) || used != len || v > 1)
+            return 0;
+        pax->sparse = v == 1 ? 2 : 1;
+    }
+    else if (stbup_pax_key_is(key, key_len, "GNU.sparse.offset"))
+    {
+        /* 0.0: offset and numbytes records alternate */
+        if (!stbup_parse_decimal(value, len, &v, &used) || used != len ||
+            (s && !stbup_tar_sparse_add(s, v, 0)))
+            return 0;
+        pax->sparse = 1;
+    }
+    else if (stbup_pax_key_is(key, key_len, "GNU.sparse.numbytes"))
+    {
+        if ((s && s->map_count == 0) || !stbup_parse_decimal(value, len, &v, &used) ||
+            used != len)
+            return 0;
+        if (s)
+            s->map[s->map_count - 1].size = v;
+    }
+    else if (stbup_pax_key_is(key, key_len, "GNU.sparse.map"))
+    {
+        /* 0.1: "offset,size,offset,size,..." */
+        uint64_t run[2];
+        for (size_t i = 0, n = 0; i < len; n++)
+        {
+            if (!stbup_parse_decimal(value + i, len - i, &run[n & 1], &used))
+                return 0;
+            i += used;
+            if (i < len && value[i++] != ',')
+                return 0;
+            if ((n & 1) && s && !stbup_tar_sparse_add(s, run[0], run[1]))
+                return 0;
+            if (i == len && !(n & 1))
+                return 0; /* odd number of values */
+        }
+        pax->sparse = 1;
+    }
+    return 1;
+}
+
+/*
+ * Take the next record of a PAX extended header, of the form
+ * "<length> <key>=<value>\n". Returns 1 for a record, 0 at the end and -1
+ * if the header is malformed.
+ */
+static int stbup_tar_pax_next(const char **p, size_t *len, const char **key, size_t *key_len,
+                              const char **value, size_t *value_len)
+{
+    if (*len == 0 || (*p)[0] == 0)
+        return 0;
+    uint64_t rec;
+    size_t used;
+    if (!stbup_parse_decimal(*p, *len, &rec, &used) || rec > *len || rec < used + 3 ||
+        (*p)[used] != ' ' || (*p)[rec - 1] != '\n')
+        return -1;
+    const char *k = *p + used + 1;
+    const char *end = *p + rec - 1;
+    const char *eq = (const char *)memchr(k, '=', (size_t)(end - k));
+    if (!eq)
+        return -1;
+    *key = k;
+    *key_len = (size_t)(eq - k);
+    *value = eq + 1;
+    *value_len = (size_t)(end - eq - 1);
+    *p += rec;
+    *len -= (size_t)rec;
+    return 1;
+}
+
+/* Parse a PAX extended header into 'pax'; see stbup_tar_pax_record for 's' */
+static int stbup_tar_pax_parse(stbup_tar_pax *pax, stbup_tar_stream *s, const char *p, size_t len)
+{
+    const char *key, *value;
+    size_t key_len, value_len;
+    int more;
+    while ((more = stbup_tar_pax_next(&p, &len, &key, &key_len, &value, &value_len)) > 0)
+    {
+        if (!stbup_tar_pax_record(pax, s, key, key_len, value, value_len))
+            return 0;
+    }
+    return more == 0;
+}
+
+/*
+ * PAX 1.0 sparse files start their data with the map in decimal text: the
+ * number of runs, then offset and size of each, one per line, padded to a
+ * whole block. Returns 1 once all of it is in s->meta, 0 if more is
+ * needed, -1 if it is malformed.
+ */
+static int stbup_tar_sparse_map_text(stbup_tar_stream *s)
+{
+    const char *p = (const char *)s->meta;
+    size_t len = s->meta_len;
+    size_t i = 0;
+    uint64_t count, run[2];
+    size_t used;
+
+    s->map_count = 0;
+    if (!stbup_parse_decimal(p, len, &count, &used))
+        return used < len ? -1 : 0;
+    i = used;
+    if (i == len)
+        return 0;
+    if (p[i++] != '\n' || count > STBUP_TAR_META_MAX / 4)
+        return -1;
+    for (uint64_t n = 0; n < 2 * count; n++)
+    {
+        if (!stbup_parse_decimal(p + i, len - i, &run[n & 1], &used))
+            return i + used < len ? -1 : 0;
+        i += used;
+        if (i == len)
+            return 0;
+        if (p[i++] != '\n')
+            return -1;
+        if ((n & 1) && !stbup_tar_sparse_add(s, run[0], run[1]))
+            return -1;
+    }
+    return 1;
+}
+
+/* Make room for 'n' more bytes of header data, up to STBUP_TAR_META_MAX in all */
+static int stbup_tar_stream_meta_reserve(stbup_tar_stream *s, size_t n)
+{
+    if (n > STBUP_TAR_META_MAX - s->meta_len)
+        return 0;
+    if (s->meta_len + n <= s->meta_cap)
+        return 1;
+    size_t cap = s->meta_cap ? s->meta_cap : 512;
+    while (cap < s->meta_len + n)
+        cap *= 2;
+    unsigned char *p = (unsigned char *)realloc(s->meta, cap);
+    if (!p)
+        return 0;
+    s->meta = p;
+    s->meta_cap = cap;
+    return 1;
+}
+
+/* Append bytes to the current file or sink entry */
+static int stbup_tar_stream_put(stbup_tar_stream *s, const unsigned char *p, size_t n)
+{
+    if (!s->sink)
+        return stbup_ofile_write(&s->file, p, n);
+    s->sink_pos += n;
+    return s->sink->write(s->sink->user, p, n);
+}
+
+/* Move the current file to 'pos', leaving a hole; a sink is sent the zeros */
+static int stbup_tar_stream_skip(stbup_tar_stream *s, uint64_t pos)
+{
+    static const unsigned char zeros[4096] = {0};
+    if (!s->sink)
+    {
+        stbup_ofile_skip(&s->file, pos);
+        return 1;
+    }
+    while (s->sink_pos < pos)
+    {
+        size_t n = pos - s->sink_pos < sizeof(zeros) ? (size_t)(pos - s->sink_pos) : sizeof(zeros);
+        if (!stbup_tar_stream_put(s, zeros, n))
+            return 0;
+    }
+    return 1;
+}
+
+/* Lay payload bytes of a sparse file out over the runs of its map */
+static int stbup_tar_stream_write_sparse(stbup_tar_stream *s, const unsigned char *p, size_t n)
+{
+    while (n > 0)
+    {
+        if (s->run_left == 0)
+        {
+            if (s->map_next == s->map_count)
+                return 0; /* more data than the map accounts for */
+            const stbup_tar_sparse *run = &s->map[s->map_next++];
+            if (!stbup_tar_stream_skip(s, run->offset))
+                return 0;
+            s->run_left = run->size;
+            continue;
+        }
+        size_t k = s->run_left < (uint64_t)n ? (size_t)s->run_left : n;
+        if (!stbup_tar_stream_put(s, p, k))
+            return 0;
+        s->run_left -= k;
+        p += k;
+        n -= k;
+    }
+    return 1;
+}
+
+/* Hand payload bytes of the current entry to wherever they are going */
+static int stbup_tar_stream_payload(stbup_tar_stream *s, const unsigned char *p, size_t n)
+{
+    while (n > 0 && s->meta_type == 'M')
+    {
+        /* the map is read a block at a time; the data starts after its last block */
+        size_t k = 512 - s->meta_len % 512;
+        if (k > n)
+            k = n;
+        if (!stbup_tar_stream_meta_reserve(s, k))
+            return 0;
+        memcpy(s->meta + s->meta_len, p, k);
+        s->meta_len += k;
+        p += k;
+        n -= k;
+        if (s->meta_len % 512 == 0)
         {
-            sum += p[i]; /* Read from struct */
+            int done = stbup_tar_sparse_map_text(s);
+            if (done < 0 || (done && !stbup_tar_sparse_check(s)))
+                return 0;
+            if (done)
+                s->meta_type = 0;
+        }
+    }
+    if (n == 0)
+        return 1;
+    if (s->meta_type)
+    {
+        memcpy(s->meta + s->meta_len, p, n);
+        s->meta_len += n;
+        return 1;
+    }
+    if (s->writing)
+        return s->sparse ? stbup_tar_stream_write_sparse(s, p, n) : stbup_tar_stream_put(s, p, n);
+    if (s->collect)
+    {
+        memcpy(s->collect + s->collect_len, p, n);
+        s->collect_len += n;
+    }
+    return 1;
+}
+
+/* Close the current entry and move on to its padding or the next header */
+static int stbup_tar_stream_end_entry(stbup_tar_stream *s)
+{
+    if (s->meta_type == 'M')
+        return stbup_tar_stream_fail(s); /* the sparse map never ended */
+    if (s->meta_type)
+    {
+        /* a header for the next entry */
+        int ok = 1;
+        if (s->meta_type == 'x')
+            ok = stbup_tar_pax_parse(&s->pax, s, (const char *)s->meta, s->meta_len);
+        else if (s->meta_len == 0 || s->meta_len >= STBUP_PATH_MAX)
+            ok = 0;
+        else
+        {
+            /* GNU long name or link name, NUL-terminated */
+            char *dst = s->meta_type == 'L' ? s->pax.path : s->pax.linkpath;
+            memcpy(dst, s->meta, s->meta_len);
+            dst[s->meta_len] = 0;
+        }
+        s->meta_type = 0;
+        s->meta_len = 0;
+        if (!ok)
+            return stbup_tar_stream_fail(s);
+        s->state = s->padding ? STBUP_TAR_STATE_PADDING : STBUP_TAR_STATE_HEADER;
+        return 1;
+    }
+    if (s->sparse && s->writing)
+    {
+        /* trailing empty runs only mark the end; then the size comes from realsize */
+        while (s->map_next < s->map_count && s->map[s->map_next].size == 0)
+            s->map_next++;
+        if (s->map_next != s->map_count || s->run_left != 0)
+            return stbup_tar_stream_fail(s); /* less data than the map accounts for */
+        if (!stbup_tar_stream_skip(s, s->realsize))
+            return stbup_tar_stream_fail(s);
+    }
+    s->sparse = 0;
+    s->map_count = 0;
+    if (s->writing)
+    {
+        int ok = s->sink ? s->sink->end(s->sink->user) : stbup_ofile_close(&s->file);
+        s->writing = 0;
+        if (!ok)
+            return stbup_tar_stream_fail(s);
+        s->files_extracted++;
+    }
+    if (s->collect)
+    {
+        unsigned char *data = s->collect;
+        s->collect = NULL;
+        if (!stbup_tar_stream_queue(s, s->collect_path, data, s->collect_len, data))
+            return stbup_tar_stream_fail(s);
+        s->files_extracted++;
+    }
+    s->state = s->padding ? STBUP_TAR_STATE_PADDING : STBUP_TAR_STATE_HEADER;
+    return 1;
+}
+
+/* Start laying the payload out by the map; 'map_in_data' for a PAX 1.0 map that precedes it */
+static int stbup_tar_stream_begin_sparse(stbup_tar_stream *s, int map_in_data)
+{
+    s->sparse = 1;
+    s->map_next = 0;
+    s->run_left = 0;
+    if (!map_in_data)
+        return stbup_tar_sparse_check(s);
+    s->meta_type = 'M';
+    s->meta_len = 0;
+    return 1;
+}
+
+/*
+ * Act on a parsed header located at s->offset (for GNU sparse files, the
+ * offset of its last extension block).
+ */
+static int stbup_tar_stream_entry(stbup_tar_stream *s, const stbup_tar_entry *ep,
+                                  const unsigned char *next, size_t avail)
+{
+    stbup_tar_entry e = *ep;
+    int meta = e.typeflag == 'x' || e.typeflag == 'X' || e.typeflag == 'L' || e.typeflag == 'K' ||
+               e.typeflag == 'g';
+    if (!meta && s->pax.size >= 0)
+        e.size = (uint64_t)s->pax.size; /* the PAX record wins over the header field */
+    if (e.size > UINT64_MAX - 511ULL)
+        return stbup_tar_stream_fail(s);
+
+    uint64_t aligned_size = (e.size + 511ULL) & ~511ULL;
+    if (s->limit != UINT64_MAX && aligned_size > s->limit - s->offset - 512)
+        return stbup_tar_stream_fail(s); /* entry runs past the end of the input */
+
+    s->remaining = e.size;
+    s->padding = aligned_size - e.size;
+    s->state = STBUP_TAR_STATE_DATA;
+
+    if (e.typeflag == 'x' || e.typeflag == 'X' || e.typeflag == 'L' || e.typeflag == 'K')
+    {
+        /* PAX extended header or GNU long name: gather it for the next entry */
+        if (e.size > STBUP_TAR_META_MAX || !stbup_tar_stream_meta_reserve(s, (size_t)e.size + 1))
+            return stbup_tar_stream_fail(s);
+        s->meta_type = e.typeflag == 'X' ? 'x' : e.typeflag;
+        s->meta_len = 0;
+        return e.size ? 1 : stbup_tar_stream_end_entry(s);
+    }
+    if (e.typeflag == 'g')
+        return e.size ? 1 : stbup_tar_stream_end_entry(s); /* PAX global header, not used */
+
+    /* what PAX and long-name headers said about this entry */
+    stbup_tar_pax pax = s->pax;
+    memset(&s->pax, 0, sizeof(s->pax));
+    s->pax.mtime = -1;
+    s->pax.size = -1;
+    if (pax.path[0])
+        memcpy(e.path, pax.path, sizeof(e.path));
+    if (pax.linkpath[0])
+        memcpy(e.linkname, pax.linkpath, sizeof(e.linkname));
+    if (pax.mtime >= 0)
+        e.mtime = (uint64_t)pax.mtime;
+    int sparse = e.typeflag == 'S' || (pax.sparse && (e.typeflag == '0' || e.typeflag == '\0'));
+    if (e.typeflag == 'S')
+        s->realsize = stbup_octal_to_u64((const char *)s->gnu_header + 483, 12);
+    else if (sparse)
+        s->realsize = pax.realsize;
+    if (!sparse)
+        s->map_count = 0;
+
+    /* advance to next header even if no name */
+    if (e.path[0] == 0)
+        return e.size ? 1 : stbup_tar_stream_end_entry(s);
+
+    /* Normalize path to prevent path traversal attacks */
+    char relpath[STBUP_PATH_MAX];
+    if (!stbup_entry_path(e.path, relpath))
+        return stbup_tar_stream_fail(s); /* Invalid path (path traversal attempt) */
+
+    /* filtered out: skip the payload before anything touches the disk */
+    if (!stbup_filter_accepts(s->filter, relpath))
+        return e.size ? 1 : stbup_tar_stream_end_entry(s);
+    if (s->checkpoint)
+        memcpy(s->last_path, relpath, sizeof(relpath));
+
+    if (s->sink)
+    {
+        /* a sink gets directories and regular files; there is nothing for links to point at */
+        if (e.typeflag == '5' && !s->sink->mkdir(s->sink->user, relpath))
+            return stbup_tar_stream_fail(s);
+        if (e.typeflag == '0' || e.typeflag == '\0' || e.typeflag == 'S')
+        {
+            int64_t mtime = e.mtime <= (uint64_t)INT64_MAX ? (int64_t)e.mtime : -1;
+            if (!s->sink->begin(s->sink->user, relpath, sparse ? s->realsize : e.size, mtime))
+                return stbup_tar_stream_fail(s);
+            s->writing = 1;
+            s->sink_pos = 0;
+            if (sparse && !stbup_tar_stream_begin_sparse(s, pax.sparse == 2 && e.typeflag != 'S'))
+                return stbup_tar_stream_fail(s);
+        }
+        return e.size ? 1 : stbup_tar_stream_end_entry(s);
+    }
+
+    if (e.typeflag == '5')
+    {
+        /* directory */
+        if (!stbup_out_mkdirs(&s->out, relpath))
+            return stbup_tar_stream_fail(s);
+    }
+#ifndef _WIN32
+    else if (e.typeflag == '1')
+    {
+        /* hard link to an entry extracted earlier: link it instead of writing the bytes again */
+        char target[STBUP_PATH_MAX];
+        if (!stbup_entry_path(e.linkname, target))
+            return stbup_tar_stream_fail(s);
+        /* nothing to link to if the filter left the target out */
+        if (stbup_filter_accepts(s->filter, target))
+        {
+            stbup_tar_stream_settle(s, target);
+            stbup_tar_stream_settle(s, relpath);
+            if (!stbup_out_link(&s->out, target, relpath, s->update))
+                return stbup_tar_stream_fail(s);
+            s->files_extracted++;
+        }
+    }
+    else if (e.typeflag == '2')
+    {
+        /* created by finish, once no later entry can be written through it */
+        if (!stbup_symlink_target_ok(relpath, e.linkname) ||
+            !stbup_tar_stream_defer_symlink(s, relpath, e.linkname))
+            return stbup_tar_stream_fail(s);
+    }
+#endif
+    else if (e.typeflag == '0' || e.typeflag == '\0' || e.typeflag == 'S')
+    {
+        /* regular file */
+        s->mtime = -1;
+        if (s->update)
+        {
+            /* an earlier copy of the same path may still be queued */
+            stbup_tar_stream_settle(s, relpath);
+            if (stbup_out_unchanged(&s->out, relpath, sparse ? s->realsize : e.size,
+                                    (int64_t)e.mtime))
+            {
+                s->files_extracted++;
+                return e.size ? 1 : stbup_tar_stream_end_entry(s);
+            }
+            if (e.mtime <= (uint64_t)INT64_MAX)
+                s->mtime = (int64_t)e.mtime;
+        }
+        if (sparse || (s->sparse_zeros && e.size >= STBUP_SPARSE_BLOCK))
+        {
+            /* written here, seeking over the holes; nothing is reserved up front */
+            stbup_tar_stream_settle(s, relpath);
+            if (!stbup_out_open(&s->out, relpath, 1, 0, &s->file))
+                return stbup_tar_stream_fail(s);
+            s->file.mtime = s->mtime;
+            s->file.sparse = s->sparse_zeros;
+            s->writing = 1;
+            if (sparse && !stbup_tar_stream_begin_sparse(s, pax.sparse == 2 && e.typeflag != 'S'))
+                return stbup_tar_stream_fail(s);
+            return e.size ? 1 : stbup_tar_stream_end_entry(s);
+        }
+        if (s->pool || s->uring)
+        {
+            /* writers only open files, so the parent has to exist before queueing */
+            char dirpath[STBUP_PATH_MAX];
+            memcpy(dirpath, relpath, sizeof(dirpath));
+            stbup_dirname(dirpath);
+            if (!stbup_out_mkdirs(&s->out, dirpath))
+                return stbup_tar_stream_fail(s); /* can't create parent dir */
+
+            /* the ring takes files that fit one write; big ones are preallocated inline */
+            if ((e.size == 0 || (s->stable && e.size <= avail)) &&
+                (!s->uring || e.size < STBUP_PREALLOC_MIN))
+            {
+                /* payload is already in memory for good: hand out a pointer to it */
+                if (!stbup_tar_stream_queue(s, relpath, next, (size_t)e.size, NULL))
+                    return stbup_tar_stream_fail(s);
+                s->files_extracted++;
+                return e.size ? 1 : stbup_tar_stream_end_entry(s);
+            }
+            if (e.size <= STBUP_POOL_COPY_MAX)
+            {
+                /* small entry from a transient buffer: gather a private copy */
+                s->collect = (unsigned char *)malloc((size_t)e.size);
+                if (!s->collect)
+                    return stbup_tar_stream_fail(s);
+                s->collect_len = 0;
+                memcpy(s->collect_path, relpath, sizeof(relpath));
+                return 1;
+            }
+            stbup_tar_stream_settle(s, relpath);
+        }
+        if (s->src_fd >= 0 && e.size <= avail)
+        {
+            /* payload lies in the archive file: copy it file to file */
+            if (!stbup_out_write_file(&s->out, relpath, 1, s->src_fd, s->offset + 512,
+                                      next, (size_t)e.size, s->mtime))
+                return stbup_tar_stream_fail(s);
+            s->files_extracted++;
+            return e.size ? 1 : stbup_tar_stream_end_entry(s);
+        }
+        /* reserve only what the input can back: a known input size already bounds e.size */
+        if (!stbup_out_open(&s->out, relpath, 1, s->limit != UINT64_MAX ? e.size : 0, &s->file))
+            return stbup_tar_stream_fail(s);
+        s->file.mtime = s->mtime;
+        s->writing = 1;
+    }
+
+    return e.size ? 1 : stbup_tar_stream_end_entry(s);
+}
+
+/*
+ * Handle a complete header block located at s->offset. 'next' and 'avail'
+ * describe the input that follows it within the current feed.
+ */
+static int stbup_tar_stream_header(stbup_tar_stream *s, const unsigned char *block,
+                                   const unsigned char *next, size_t avail)
+{
+    /* end of archive = zero block */
+    if (stbup_block_is_zero(block))
+    {
+        s->state = STBUP_TAR_STATE_END;
+        return 1;
+    }
+
+    if (s->verify && !stbup_tar_checksum_ok(block))
+        return stbup_tar_stream_fail(s); /* corrupt header, or not a TAR at all */
+
+    stbup_tar_entry e;
+    if (!stbup_tar_parse_header(block, &e))
+        return stbup_tar_stream_fail(s);
+
+    if (e.typeflag == 'S')
+    {
+        /* old GNU sparse file: four runs in the header, more in extension blocks */
+        s->map_count = 0;
+        memcpy(s->gnu_header, block, 512);
+        if (!stbup_tar_sparse_add_gnu(s, block + 386, 4))
+            return stbup_tar_stream_fail(s);
+        if (block[482])
+        {
+            s->state = STBUP_TAR_STATE_SPARSE;
+            return 1;
+        }
+    }
+    return stbup_tar_stream_entry(s, &e, next, avail);
+}
+
+/* A GNU sparse extension block: 21 more runs and whether another block follows */
+static int stbup_tar_stream_sparse_block(stbup_tar_stream *s, const unsigned char *block,
+                                         const unsigned char *next, size_t avail)
+{
+    if (!stbup_tar_sparse_add_gnu(s, block, 21))
+        return stbup_tar_stream_fail(s);
+    if (block[504])
+        return 1;
+    stbup_tar_entry e;
+    stbup_tar_parse_header(s->gnu_header, &e); /* did not fail the first time */
+    return stbup_tar_stream_entry(s, &e, next, avail);
+}
+
+/* Push the next chunk of the archive; returns 0 once the archive is known to be bad */
+static int stbup_tar_stream_feed(stbup_tar_stream *s, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    while (size > 0)
+    {
+        if (s->state == STBUP_TAR_STATE_END)
+            return 1; /* trailing data after the end marker is ignored */
+        if (s->state == STBUP_TAR_STATE_ERROR)
+            return 0;
+
+        if (s->state == STBUP_TAR_STATE_HEADER || s->state == STBUP_TAR_STATE_SPARSE)
+        {
+            /* nothing is pending between two entries, so that is where the journal is written */
+            if (s->checkpoint && s->offset >= s->checkpoint_next &&
+                s->state == STBUP_TAR_STATE_HEADER && s->block_fill == 0 && !s->meta_type &&
+                !s->pax.path[0] && !s->pax.linkpath[0] && s->pax.mtime < 0 && s->pax.size < 0 &&
+                !s->pax.sparse &&
+                !stbup_tar_stream_checkpoint(s))
+                return stbup_tar_stream_fail(s);
+
+            /* headers and GNU sparse extension blocks come as whole blocks */
+            int (*handle)(stbup_tar_stream *, const unsigned char *, const unsigned char *,
+                          size_t) = s->state == STBUP_TAR_STATE_SPARSE
+                                        ? stbup_tar_stream_sparse_block
+                                        : stbup_tar_stream_header;
+            if (s->block_fill == 0 && size >= 512)
+            {
+                /* whole block available, parse it in place */
+                if (!handle(s, p, p + 512, size - 512))
+                    return 0;
+                s->offset += 512;
+                p += 512;
+                size -= 512;
+                continue;
+            }
+
+            size_t n = 512 - s->block_fill;
+            if (n > size)
+                n = size;
+            memcpy(s->block + s->block_fill, p, n);
+            s->block_fill += n;
+            p += n;
+            size -= n;
+            if (s->block_fill == 512)
+            {
+                s->block_fill = 0;
+                if (!handle(s, s->block, p, size))
+                    return 0;
+                s->offset += 512;
+            }
+        }
+        else if (s->state == STBUP_TAR_STATE_DATA)
+        {
+            size_t n = (s->remaining < (uint64_t)size) ? (size_t)s->remaining : size;
+            if (!stbup_tar_stream_payload(s, p, n))
+                return stbup_tar_stream_fail(s);
+            s->remaining -= n;
+            s->offset += n;
+            p += n;
+            size -= n;
+            if (s->remaining == 0 && !stbup_tar_stream_end_entry(s))
+                return 0;
         }
         else
         {
-            /* Padding bytes (after struct, bytes 500-511) - zeros */
-            sum += 0;
+            size_t n = (s->padding < (uint64_t)size) ? (size_t)s->padding : size;
+            s->padding -= n;
+            s->offset += n;
+            p += n;
+            size -= n;
+            if (s->padding == 0)
+                s->state = STBUP_TAR_STATE_HEADER;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Signal end of input. Fails if the input stopped inside an entry;
+ * otherwise returns 1 if at least one file was extracted.
+ */
+static int stbup_tar_stream_finish(stbup_tar_stream *s)
+{
+    if (s->state == STBUP_TAR_STATE_ERROR)
+        return 0;
+    if (s->state == STBUP_TAR_STATE_DATA || s->state == STBUP_TAR_STATE_PADDING ||
+        s->state == STBUP_TAR_STATE_SPARSE)
+        return stbup_tar_stream_fail(s); /* truncated entry */
+#if STBUP_THREADS
+    if (s->pool)
+    {
+        int ok = stbup_pool_destroy(s->pool, 0);
+        s->pool = NULL;
+        if (!ok)
+            return stbup_tar_stream_fail(s);
+    }
+#endif
+#if STBUP_USE_IO_URING
+    if (s->uring)
+    {
+        int ok = stbup_uring_destroy(s->uring);
+        s->uring = NULL;
+        if (!ok)
+            return stbup_tar_stream_fail(s);
+    }
+#endif
+#ifndef _WIN32
+    /* symlinks go last, after every write that could have gone through them */
+    for (size_t i = 0; i < s->symlinks_len;)
+    {
+        const char *rel = s->symlinks + i;
+        const char *target = rel + strlen(rel) + 1;
+        i = (size_t)(target - s->symlinks) + strlen(target) + 1;
+        if (!stbup_out_symlink(&s->out, rel, target, s->update))
+            return stbup_tar_stream_fail(s);
+        s->files_extracted++;
+    }
+    free(s->symlinks);
+    s->symlinks = NULL;
+#endif
+    free(s->meta);
+    s->meta = NULL;
+    free(s->map);
+    s->map = NULL;
+    if (s->files_extracted > 0 && !stbup_out_commit(&s->out))
+        return stbup_tar_stream_fail(s);
+    stbup_out_free(&s->out);
+    if (s->checkpoint)
+        remove(s->checkpoint); /* nothing left to resume */
+    return s->files_extracted > 0;
+}
+
+/*
+ * Extract a whole in-memory archive; src_fd is the file it was mapped from,
+ * or -1, and 'st' that file's status, or NULL.
+ */
+static int stbup_tar_extract_buffer(const void *tar_data, size_t tar_size, int src_fd,
+                                    const struct stat *st, const char *out_dir,
+                                    const stbup_extract_options *opts)
+{
+    stbup_tar_stream s;
+    stbup_tar_stream_init_ex(&s, out_dir, opts);
+    s.limit = tar_size;
+    s.stable = 1;
+    s.src_fd = src_fd;
+
+    if (s.checkpoint)
+    {
+        /* continue after the last entry a killed run recorded */
+        s.input_size = tar_size;
+        s.input_id = stbup_checkpoint_id(tar_data, tar_size);
+        s.input_data = (const unsigned char *)tar_data;
+        if (st)
+            stbup_checkpoint_file(&s, st);
+        if (stbup_tar_stream_resume(&s) < 0)
+            return stbup_tar_stream_fail(&s);
+    }
+
+    /* a trailing partial block is ignored, as if the archive ended there */
+    if (!stbup_tar_stream_feed(&s, (const unsigned char *)tar_data + s.offset,
+                               tar_size - (size_t)s.offset))
+        return 0;
+    return stbup_tar_stream_finish(&s);
+}
+
+static int stbup_tar_extract_stream_ex(const void *tar_data, size_t tar_size,
+                                       const char *out_dir, const stbup_extract_options *opts)
+{
+    return stbup_tar_extract_buffer(tar_data, tar_size, -1, NULL, out_dir, opts);
+}
+
+static int stbup_tar_extract_stream(const void *tar_data, size_t tar_size,
+                                    const char *out_dir)
+{
+    return stbup_tar_extract_stream_ex(tar_data, tar_size, out_dir, NULL);
+}
+
+/*
+ * Extract a TAR archive from disk, running the parser over a mapping of the
+ * file. Entry payloads are copied straight from the archive file to the
+ * output files where the kernel supports it.
+ */
+static int stbup_tar_extract_ex(const char *archive_path, const char *out_dir,
+                                const stbup_extract_options *opts)
+{
+    stbup_file_view v;
+    if (!stbup_file_view_open(&v, archive_path))
+        return 0;
+    int src_fd = STBUP_USE_COPY_RANGE ? v.fd : -1;
+    struct stat st;
+    int known = stat(archive_path, &st) == 0;
+    int ret = stbup_tar_extract_buffer(v.data, v.size, src_fd, known ? &st : NULL, out_dir, opts);
+    stbup_file_view_close(&v);
+    return ret;
+}
+
+static int stbup_tar_extract(const char *archive_path, const char *out_dir)
+{
+    return stbup_tar_extract_ex(archive_path, out_dir, NULL);
+}
+
+/* ============================================================
+   TAR index
+   ============================================================ */
+
+/* One archive member as recorded by stbup_tar_index_build */
+typedef struct
+{
+    uint64_t offset; /* position of the payload in the archive */
+    uint64_t size;   /* for a sparse file, its full size with the holes */
+    uint64_t mtime;
+    uint32_t name; /* offset of the normalized path in the index's name pool */
+    char typeflag;
+    char sparse; /* GNU or PAX sparse file: listed, but not read or extracted */
+} stbup_tar_member;
+
+/*
+ * Table of contents of a TAR file, built from the headers alone. Members
+ * can be looked up by name and read or extracted one at a time.
+ */
+typedef struct
+{
+    stbup_tar_member *members;
+    size_t count;
+    size_t capacity;
+    char *names; /* NUL-terminated paths, back to back */
+    size_t names_len;
+    size_t names_cap;
+    uint32_t *lookup; /* open addressing by name: member index + 1, or 0 */
+    size_t lookup_cap;
+    char *archive_path;
+} stbup_tar_index;
+
+static void stbup_tar_index_free(stbup_tar_index *idx)
+{
+    free(idx->members);
+    free(idx->names);
+    free(idx->lookup);
+    free(idx->archive_path);
+    memset(idx, 0, sizeof(*idx));
+}
+
+static const char *stbup_tar_index_name(const stbup_tar_index *idx, size_t i)
+{
+    return idx->names + idx->members[i].name;
+}
+
+static int stbup_tar_index_add(stbup_tar_index *idx, const stbup_tar_entry *e,
+                               const char *path, uint64_t offset)
+{
+    size_t len = strlen(path) + 1;
+    if (idx->names_len + len > UINT32_MAX || idx->count >= UINT32_MAX - 1)
+        return 0;
+    if (idx->names_len + len > idx->names_cap)
+    {
+        size_t cap = idx->names_cap ? idx->names_cap * 2 : 4096;
+        while (cap < idx->names_len + len)
+            cap *= 2;
+        char *names = (char *)realloc(idx->names, cap);
+        if (!names)
+            return 0;
+        idx->names = names;
+        idx->names_cap = cap;
+    }
+    if (idx->count == idx->capacity)
+    {
+        size_t cap = idx->capacity ? idx->capacity * 2 : 64;
+        stbup_tar_member *members =
+            (stbup_tar_member *)realloc(idx->members, cap * sizeof(stbup_tar_member));
+        if (!members)
+            return 0;
+        idx->members = members;
+        idx->capacity = cap;
+    }
+
+    stbup_tar_member *m = &idx->members[idx->count++];
+    m->offset = offset;
+    m->size = e->size;
+    m->mtime = e->mtime;
+    m->name = (uint32_t)idx->names_len;
+    m->typeflag = e->typeflag;
+    m->sparse = 0;
+    memcpy(idx->names + idx->names_len, path, len);
+    idx->names_len += len;
+    return 1;
+}
+
+/* Hash every member by name; a later member with the same name replaces an earlier one */
+static int stbup_tar_index_hash(stbup_tar_index *idx)
+{
+    size_t cap = 16;
+    while (cap < idx->count * 2)
+        cap *= 2;
+    idx->lookup = (uint32_t *)calloc(cap, sizeof(uint32_t));
+    if (!idx->lookup)
+        return 0;
+    idx->lookup_cap = cap;
+
+    for (size_t i = 0; i < idx->count; i++)
+    {
+        const char *name = stbup_tar_index_name(idx, i);
+        size_t pos = stbup_hash_path(name, strlen(name)) & (cap - 1);
+        while (idx->lookup[pos] && strcmp(stbup_tar_index_name(idx, idx->lookup[pos] - 1), name) != 0)
+            pos = (pos + 1) & (cap - 1);
+        idx->lookup[pos] = (uint32_t)i + 1;
+    }
+    return 1;
+}
+
+/*
+ * Read a PAX extended header ('x') or GNU long name ('L', 'K') payload at
+ * the current position into 'pax', for the member that follows it.
+ */
+static int stbup_tar_index_meta(FILE *f, char typeflag, size_t len, stbup_tar_pax *pax)
+{
+    char *buf = (char *)malloc(len ? len : 1);
+    if (!buf)
+        return 0;
+    int ok = fread(buf, 1, len, f) == len;
+    if (ok && typeflag == 'x')
+    {
+        ok = stbup_tar_pax_parse(pax, NULL, buf, len);
+    }
+    else if (ok)
+    {
+        /* NUL-terminated, as the stream takes it */
+        char *dst = typeflag == 'L' ? pax->path : pax->linkpath;
+        ok = len > 0 && len < STBUP_PATH_MAX;
+        if (ok)
+        {
+            memcpy(dst, buf, len);
+            dst[len] = 0;
+        }
+    }
+    free(buf);
+    return ok;
+}
+
+/*
+ * Scan the headers of a TAR file, seeking over every payload, and record
+ * each named member. Fails on bad checksums, unsafe paths and truncated
+ * archives, like extraction does.
+ */
+static int stbup_tar_index_build(const char *archive_path, stbup_tar_index *idx)
+{
+    memset(idx, 0, sizeof(*idx));
+    FILE *f = fopen(archive_path, "rb");
+    if (!f)
+        return 0;
+
+    uint64_t file_size = 0;
+    int ok = stbup_fsize64(f, &file_size) && stbup_fseek64(f, 0);
+    uint64_t pos = 0;
+    unsigned char block[512];
+    stbup_tar_pax pax; /* from PAX headers and GNU long names, for the member that follows */
+    memset(&pax, 0, sizeof(pax));
+    pax.mtime = -1;
+    pax.size = -1;
+
+    while (ok && pos + 512 <= file_size)
+    {
+        if (fread(block, 1, 512, f) != 512)
+        {
+            ok = 0;
+            break;
+        }
+        if (stbup_block_is_zero(block))
+            break;
+
+        stbup_tar_entry e;
+        if (!stbup_tar_checksum_ok(block) || !stbup_tar_parse_header(block, &e))
+        {
+            ok = 0;
+            break;
+        }
+        /* headers for the next member, and PAX global headers, which are not used */
+        char meta = e.typeflag == 'X' ? 'x' : e.typeflag;
+        int gather = meta == 'x' || meta == 'L' || meta == 'K';
+        int is_meta = gather || meta == 'g';
+        if (!is_meta && pax.size >= 0)
+            e.size = (uint64_t)pax.size;
+        uint64_t aligned_size = (e.size + 511ULL) & ~511ULL;
+        if (e.size > UINT64_MAX - 511ULL || aligned_size > file_size - pos - 512 ||
+            (gather && e.size > STBUP_TAR_META_MAX))
+        {
+            ok = 0; /* entry runs past the end of the file */
+            break;
+        }
+        if (gather && !stbup_tar_index_meta(f, meta, (size_t)e.size, &pax))
+        {
+            ok = 0;
+            break;
+        }
+
+        uint64_t realsize = e.size;
+        int sparse = e.typeflag == 'S' || (pax.sparse && (e.typeflag == '0' || e.typeflag == '\0'));
+        if (e.typeflag == 'S')
+            realsize = stbup_octal_to_u64((const char *)block + 483, 12);
+        else if (sparse)
+            realsize = pax.realsize;
+
+        /* old GNU sparse files continue their map in extension blocks before the data */
+        uint64_t data_pos = pos + 512;
+        int more = e.typeflag == 'S' && block[482];
+        while (ok && more)
+        {
+            ok = aligned_size <= file_size - data_pos - 512 && fread(block, 1, 512, f) == 512;
+            more = block[504];
+            data_pos += 512;
+        }
+        if (!ok)
+            break;
+
+        if (!is_meta)
+        {
+            /* what the headers before it said about this member */
+            if (pax.path[0])
+                memcpy(e.path, pax.path, sizeof(e.path));
+            if (pax.mtime >= 0)
+                e.mtime = (uint64_t)pax.mtime;
+            memset(&pax, 0, sizeof(pax));
+            pax.mtime = -1;
+            pax.size = -1;
+        }
+        if (!is_meta && e.path[0])
+        {
+            char relpath[STBUP_PATH_MAX];
+            if (!stbup_entry_path(e.path, relpath) || !stbup_tar_index_add(idx, &e, relpath, data_pos))
+            {
+                ok = 0;
+                break;
+            }
+            stbup_tar_member *m = &idx->members[idx->count - 1];
+            m->size = realsize;
+            m->sparse = (char)sparse;
+        }
+
+        pos = data_pos + aligned_size;
+        if (aligned_size && !stbup_fseek64(f, pos))
+            ok = 0;
+    }
+    fclose(f);
+
+    size_t path_len = strlen(archive_path) + 1;
+    if (ok)
+    {
+        idx->archive_path = (char *)malloc(path_len);
+        ok = idx->archive_path && stbup_tar_index_hash(idx);
+    }
+    if (!ok)
+    {
+        stbup_tar_index_free(idx);
+        return 0;
+    }
+    memcpy(idx->archive_path, archive_path, path_len);
+    return 1;
+}
+
+/* Find a member by path ("./a//b" finds "a/b"); the last one wins if a name repeats */
+static int stbup_tar_index_find(const stbup_tar_index *idx, const char *name, size_t *index)
+{
+    char relpath[STBUP_PATH_MAX];
+    if (!idx->lookup || !stbup_entry_path(name, relpath))
+        return 0;
+    size_t cap = idx->lookup_cap;
+    size_t pos = stbup_hash_path(relpath, strlen(relpath)) & (cap - 1);
+    while (idx->lookup[pos])
+    {
+        size_t i = idx->lookup[pos] - 1;
+        if (strcmp(stbup_tar_index_name(idx, i), relpath) == 0)
+        {
+            *index = i;
+            return 1;
+        }
+        pos = (pos + 1) & (cap - 1);
+    }
+    return 0;
+}
+
+/* Read the payload of member i into a malloc'd buffer; sparse members are not supported */
+static int stbup_tar_index_read(const stbup_tar_index *idx, size_t i, void **data, size_t *size)
+{
+    const stbup_tar_member *m = &idx->members[i];
+    if (m->sparse || m->size > (uint64_t)SIZE_MAX)
+        return 0;
+    FILE *f = fopen(idx->archive_path, "rb");
+    if (!f)
+        return 0;
+
+    void *buf = malloc(m->size ? (size_t)m->size : 1);
+    int ok = buf && stbup_fseek64(f, m->offset) &&
+             fread(buf, 1, (size_t)m->size, f) == (size_t)m->size;
+    fclose(f);
+    if (!ok)
+    {
+        free(buf);
+        return 0;
+    }
+    *data = buf;
+    *size = (size_t)m->size;
+    return 1;
+}
+
+/*
+ * Extract member i (a directory or regular file, not a sparse one) below
+ * out_dir, without touching the rest of the archive. The payload is copied file to file in
+ * the kernel where possible.
+ */
+static int stbup_tar_index_extract(const stbup_tar_index *idx, size_t i, const char *out_dir)
+{
+    const stbup_tar_member *m = &idx->members[i];
+    const char *rel = stbup_tar_index_name(idx, i);
+    stbup_out out;
+    stbup_out_init(&out, out_dir);
+
+    int ok = 0;
+    if (m->typeflag == '5')
+    {
+        ok = stbup_out_mkdirs(&out, rel);
+    }
+    else if ((m->typeflag == '0' || m->typeflag == '\0') && !m->sparse &&
+             m->size <= (uint64_t)SIZE_MAX)
+    {
+        FILE *in = fopen(idx->archive_path, "rb");
+        stbup_ofile file;
+        if (in && stbup_out_open(&out, rel, 1, m->size, &file))
+        {
+            size_t size = (size_t)m->size;
+            size_t done = 0;
+#if STBUP_USE_COPY_RANGE
+            done = stbup_ofile_copy(&file, fileno(in), m->offset, size);
+#endif
+            ok = 1;
+            if (done < size)
+            {
+                unsigned char *buf = (unsigned char *)malloc(STBUP_STREAM_CHUNK);
+                ok = buf && stbup_fseek64(in, m->offset + done);
+                while (ok && done < size)
+                {
+                    size_t n = size - done < STBUP_STREAM_CHUNK ? size - done : STBUP_STREAM_CHUNK;
+                    ok = fread(buf, 1, n, in) == n && stbup_ofile_write(&file, buf, n);
+                    done += n;
+                }
+                free(buf);
+            }
+            if (!stbup_ofile_close(&file))
+                ok = 0;
         }
+        if (in)
+            fclose(in);
     }
-    return sum;
+    stbup_out_free(&out);
+    return ok;
 }
 
 /* ============================================================
-   TAR streaming extractor
+   Directory walking
    ============================================================ */
 
-static int stbup_tar_extract_stream(const void *tar_data, size_t tar_size,
-                                    const char *out_dir)
+#ifdef _WIN32
+typedef struct _stat stbup_stat;
+#else
+typedef struct stat stbup_stat;
+#endif
+
+/* Metadata of a path itself: symlinks are not followed where they exist */
+static int stbup_lstat(const char *path, stbup_stat *st)
+{
+#ifdef _WIN32
+    return _stat(path, st) == 0;
+#else
+    return lstat(path, st) == 0;
+#endif
+}
+
+/* Metadata of what a path refers to, following symlinks */
+static int stbup_stat_path(const char *path, stbup_stat *st)
+{
+#ifdef _WIN32
+    return _stat(path, st) == 0;
+#else
+    return stat(path, st) == 0;
+#endif
+}
+
+static int stbup_stat_is_dir(const stbup_stat *st)
+{
+    return (st->st_mode & S_IFMT) == S_IFDIR;
+}
+
+static int stbup_stat_is_file(const stbup_stat *st)
+{
+    return (st->st_mode & S_IFMT) == S_IFREG;
+}
+
+/* Open directory being listed */
+typedef struct
+{
+#ifdef _WIN32
+    HANDLE handle;
+    WIN32_FIND_DATAA data;
+    int first;
+#else
+    DIR *dir;
+#endif
+} stbup_dir_iter;
+
+static int stbup_dir_iter_open(stbup_dir_iter *it, const char *path)
+{
+#ifdef _WIN32
+    char pattern[STBUP_PATH_MAX];
+    int n = snprintf(pattern, sizeof(pattern), "%s\\*", path);
+    if (n < 0 || (size_t)n >= sizeof(pattern))
+        return 0;
+    it->handle = FindFirstFileA(pattern, &it->data);
+    it->first = 1;
+    return it->handle != INVALID_HANDLE_VALUE;
+#else
+    it->dir = opendir(path);
+    return it->dir != NULL;
+#endif
+}
+
+/* Name of the next entry, skipping "." and ".."; NULL once there are no more */
+static const char *stbup_dir_iter_next(stbup_dir_iter *it)
+{
+    for (;;)
+    {
+#ifdef _WIN32
+        if (!it->first && !FindNextFileA(it->handle, &it->data))
+            return NULL;
+        it->first = 0;
+        const char *name = it->data.cFileName;
+#else
+        struct dirent *de = readdir(it->dir);
+        if (!de)
+            return NULL;
+        const char *name = de->d_name;
+#endif
+        if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+            return name;
+    }
+}
+
+static void stbup_dir_iter_close(stbup_dir_iter *it)
+{
+#ifdef _WIN32
+    FindClose(it->handle);
+#else
+    closedir(it->dir);
+#endif
+}
+
+/* Metadata of the entry 'name' just returned by the iterator over the directory 'path' */
+static int stbup_dir_iter_stat(stbup_dir_iter *it, const char *path, const char *name, stbup_stat *st)
+{
+#ifdef _WIN32
+    (void)it;
+    char full[STBUP_PATH_MAX];
+    int n = snprintf(full, sizeof(full), "%s/%s", path, name);
+    return n >= 0 && (size_t)n < sizeof(full) && stbup_lstat(full, st);
+#else
+    /* relative to the open directory: no path walk per entry */
+    (void)path;
+    return fstatat(dirfd(it->dir), name, st, AT_SYMLINK_NOFOLLOW) == 0;
+#endif
+}
+
+/* Called for every entry of a tree, with its metadata from stbup_lstat; returns 0 to stop */
+typedef int (*stbup_walk_fn)(void *user, const char *path, const char *name, const stbup_stat *st);
+
+struct stbup_scan_dir;
+
+/* One entry of a directory listing */
+typedef struct
+{
+    char *name;
+    stbup_stat st;
+    struct stbup_scan_dir *dir; /* listing of this subdirectory, or NULL */
+} stbup_scan_item;
+
+enum
+{
+    STBUP_SCAN_PENDING, /* waiting to be listed */
+    STBUP_SCAN_BUSY,    /* a worker is listing it */
+    STBUP_SCAN_DONE,
+    STBUP_SCAN_FAILED
+};
+
+/* A directory of the tree with its entries and their metadata, read in one go */
+typedef struct stbup_scan_dir
+{
+    char *path; /* on disk */
+    stbup_scan_item *items;
+    size_t count;
+    int state;
+    struct stbup_scan_dir *prev, *next; /* in the list of directories waiting for a worker */
+} stbup_scan_dir;
+
+/*
+ * Directory listings for stbup_walk. The calling thread walks the tree in
+ * order and lists each directory when it gets there; scan workers list
+ * directories it has not reached yet, so the readdir and stat latency of
+ * a cold or remote tree overlaps with writing the archive. Workers stay
+ * at most STBUP_SCAN_AHEAD entries ahead.
+ */
+typedef struct
+{
+    int sort; /* 1: entries of each directory in byte order of their names, not readdir order */
+#if STBUP_THREADS
+    stbup_mutex lock;
+    stbup_cond cond;         /* a listing finished, a directory was queued, or room was freed */
+    stbup_scan_dir *pending; /* directories waiting for a worker, the one needed soonest first */
+    size_t ahead;            /* listed entries the walk has not reached yet */
+    int shutdown;
+    int num_threads;
+    stbup_thread threads[STBUP_POOL_MAX_THREADS];
+#endif
+} stbup_scan;
+
+static stbup_scan_dir *stbup_scan_dir_new(const char *path, size_t len)
+{
+    stbup_scan_dir *d = (stbup_scan_dir *)calloc(1, sizeof(stbup_scan_dir));
+    if (d && (d->path = (char *)malloc(len + 1)) != NULL)
+    {
+        memcpy(d->path, path, len);
+        d->path[len] = 0;
+        return d;
+    }
+    free(d);
+    return NULL;
+}
+
+/* Free a listing and every listing below it */
+static void stbup_scan_dir_free(stbup_scan_dir *d)
+{
+    if (!d)
+        return;
+    for (size_t i = 0; i < d->count; i++)
+    {
+        free(d->items[i].name);
+        stbup_scan_dir_free(d->items[i].dir);
+    }
+    free(d->items);
+    free(d->path);
+    free(d);
+}
+
+static int stbup_scan_item_cmp(const void *a, const void *b)
+{
+    return strcmp(((const stbup_scan_item *)a)->name, ((const stbup_scan_item *)b)->name);
+}
+
+/*
+ * Read a directory with the metadata of all its entries, each stat taken
+ * relative to the open directory, and set up (unlisted) nodes for its
+ * subdirectories. Returns 0 on any error, including a path that would not
+ * fit STBUP_PATH_MAX.
+ */
+static int stbup_scan_list(stbup_scan_dir *d, int sort)
+{
+    stbup_dir_iter it;
+    if (!stbup_dir_iter_open(&it, d->path))
+        return 0;
+
+    size_t cap = 0;
+    size_t path_len = strlen(d->path);
+    const char *entry;
+    int ok = 1;
+    while (ok && (entry = stbup_dir_iter_next(&it)) != NULL)
+    {
+        size_t n = strlen(entry);
+        ok = path_len + n + 2 <= STBUP_PATH_MAX;
+        if (ok && d->count == cap)
+        {
+            cap = cap ? 2 * cap : 16;
+            stbup_scan_item *p = (stbup_scan_item *)realloc(d->items, cap * sizeof(*p));
+            ok = p != NULL;
+            if (ok)
+                d->items = p;
+        }
+        if (!ok)
+            break;
+
+        stbup_scan_item *item = &d->items[d->count];
+        item->dir = NULL;
+        item->name = (char *)malloc(n + 1);
+        ok = item->name && stbup_dir_iter_stat(&it, d->path, entry, &item->st);
+        if (!ok)
+        {
+            free(item->name);
+            break;
+        }
+        memcpy(item->name, entry, n + 1);
+        d->count++;
+    }
+    stbup_dir_iter_close(&it);
+    if (ok && sort)
+        qsort(d->items, d->count, sizeof(*d->items), stbup_scan_item_cmp);
+
+    char child[STBUP_PATH_MAX];
+    for (size_t i = 0; ok && i < d->count; i++)
+    {
+        if (!stbup_stat_is_dir(&d->items[i].st))
+            continue;
+        int n = snprintf(child, sizeof(child), "%s/%s", d->path, d->items[i].name);
+        d->items[i].dir = stbup_scan_dir_new(child, (size_t)n);
+        ok = d->items[i].dir != NULL;
+    }
+    return ok;
+}
+
+#if STBUP_THREADS
+/* Queue the subdirectories of a fresh listing for the workers. Called with the lock held */
+static void stbup_scan_queue(stbup_scan *scan, stbup_scan_dir *d)
+{
+    /* in reverse, so that the first subdirectory is the first one taken */
+    for (size_t i = d->count; i-- > 0;)
+    {
+        stbup_scan_dir *c = d->items[i].dir;
+        if (!c)
+            continue;
+        c->prev = NULL;
+        c->next = scan->pending;
+        if (scan->pending)
+            scan->pending->prev = c;
+        scan->pending = c;
+    }
+}
+
+static void stbup_scan_unlink(stbup_scan *scan, stbup_scan_dir *d)
 {
-    const unsigned char *p = (const unsigned char *)tar_data;
-    const unsigned char *end = p + tar_size;
-    int files_extracted = 0;
+    if (d->prev)
+        d->prev->next = d->next;
+    else
+        scan->pending = d->next;
+    if (d->next)
+        d->next->prev = d->prev;
+    d->prev = d->next = NULL;
+}
 
-    while (p + 512 <= end)
+#ifdef _WIN32
+static DWORD WINAPI stbup_scan_thread(LPVOID arg)
+#else
+static void *stbup_scan_thread(void *arg)
+#endif
+{
+    stbup_scan *scan = (stbup_scan *)arg;
+    stbup_mutex_lock(&scan->lock);
+    for (;;)
     {
-        const stbup_tar_header *h = (const stbup_tar_header *)p;
+        while (!scan->shutdown && (!scan->pending || scan->ahead >= STBUP_SCAN_AHEAD))
+            stbup_cond_wait(&scan->cond, &scan->lock);
+        if (scan->shutdown)
+            break;
+
+        stbup_scan_dir *d = scan->pending;
+        stbup_scan_unlink(scan, d);
+        d->state = STBUP_SCAN_BUSY;
+        stbup_mutex_unlock(&scan->lock);
+
+        int ok = stbup_scan_list(d, scan->sort);
+
+        stbup_mutex_lock(&scan->lock);
+        d->state = ok ? STBUP_SCAN_DONE : STBUP_SCAN_FAILED;
+        if (ok)
+        {
+            scan->ahead += d->count;
+            stbup_scan_queue(scan, d);
+        }
+        stbup_cond_broadcast(&scan->cond);
+    }
+    stbup_mutex_unlock(&scan->lock);
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+#endif
+
+/* Start up to num_threads scan workers; with none the walk lists every directory itself */
+static void stbup_scan_init(stbup_scan *scan, int num_threads, int sort)
+{
+    memset(scan, 0, sizeof(*scan));
+    scan->sort = sort;
+#if STBUP_THREADS
+    stbup_mutex_init(&scan->lock);
+    stbup_cond_init(&scan->cond);
+    if (num_threads > STBUP_POOL_MAX_THREADS)
+        num_threads = STBUP_POOL_MAX_THREADS;
+    while (scan->num_threads < num_threads &&
+           stbup_thread_start(&scan->threads[scan->num_threads], stbup_scan_thread, scan))
+        scan->num_threads++;
+#else
+    (void)num_threads;
+#endif
+}
+
+static void stbup_scan_shutdown(stbup_scan *scan)
+{
+#if STBUP_THREADS
+    stbup_mutex_lock(&scan->lock);
+    scan->shutdown = 1;
+    stbup_cond_broadcast(&scan->cond);
+    stbup_mutex_unlock(&scan->lock);
+    for (int i = 0; i < scan->num_threads; i++)
+        stbup_thread_join(scan->threads[i]);
+    stbup_cond_destroy(&scan->cond);
+    stbup_mutex_destroy(&scan->lock);
+#else
+    (void)scan;
+#endif
+}
+
+/* Get the listing of a directory the walk has reached: taken from a worker, or read right here */
+static int stbup_scan_take(stbup_scan *scan, stbup_scan_dir *d)
+{
+#if STBUP_THREADS
+    if (scan->num_threads > 0)
+    {
+        stbup_mutex_lock(&scan->lock);
+        while (d->state == STBUP_SCAN_BUSY)
+            stbup_cond_wait(&scan->cond, &scan->lock);
+        int state = d->state;
+        if (state == STBUP_SCAN_PENDING)
+        {
+            stbup_scan_unlink(scan, d);
+            d->state = STBUP_SCAN_BUSY;
+        }
+        else if (state == STBUP_SCAN_DONE)
+        {
+            /* wake the workers only if they were held back */
+            if (scan->ahead >= STBUP_SCAN_AHEAD && scan->ahead - d->count < STBUP_SCAN_AHEAD)
+                stbup_cond_broadcast(&scan->cond);
+            scan->ahead -= d->count;
+        }
+        stbup_mutex_unlock(&scan->lock);
+        if (state != STBUP_SCAN_PENDING)
+            return state == STBUP_SCAN_DONE;
+
+        int ok = stbup_scan_list(d, scan->sort);
+        stbup_mutex_lock(&scan->lock);
+        d->state = ok ? STBUP_SCAN_DONE : STBUP_SCAN_FAILED;
+        if (ok)
+            stbup_scan_queue(scan, d);
+        stbup_cond_broadcast(&scan->cond);
+        stbup_mutex_unlock(&scan->lock);
+        return ok;
+    }
+#endif
+    return stbup_scan_list(d, scan->sort);
+}
+
+/* Walk the listing of 'd' in order; 'path' and 'name' are extended as in stbup_walk */
+static int stbup_scan_walk(stbup_scan *scan, stbup_scan_dir *d, char *path, char *name,
+                           stbup_walk_fn visit, void *user)
+{
+    if (!stbup_scan_take(scan, d))
+        return 0;
 
-        /* end of archive = two zero blocks */
-        int empty = 1;
-        for (int i = 0; i < 512; i++)
+    int ok = 1;
+    size_t path_len = strlen(path);
+    size_t name_len = strlen(name);
+    for (size_t i = 0; ok && i < d->count; i++)
+    {
+        stbup_scan_item *item = &d->items[i];
+        const char *entry = item->name;
+        size_t n = strlen(entry);
+        if (name_len + n + 2 > STBUP_PATH_MAX)
+        {
+            ok = 0;
+            break;
+        }
+        path[path_len] = '/';
+        memcpy(path + path_len + 1, entry, n + 1);
+        if (name_len)
+            name[name_len] = '/';
+        memcpy(name + name_len + (name_len ? 1 : 0), entry, n + 1);
+
+        ok = visit(user, path, name, &item->st);
+        if (ok && item->dir)
         {
-            if (p[i] != 0)
+            ok = stbup_scan_walk(scan, item->dir, path, name, visit, user);
+            if (ok)
             {
-                empty = 0;
-                break;
+                /* finished, so nothing below it is queued or being listed */
+                stbup_scan_dir_free(item->dir);
+                item->dir = NULL;
             }
         }
-        if (empty)
-            break;
+        path[path_len] = 0;
+        name[name_len] = 0;
+    }
+    return ok;
+}
+
+/*
+ * Visit everything below the directory 'path', a directory before its
+ * contents. Each entry is passed with its path on disk and with 'name'
+ * extended by its path relative to the start; both are STBUP_PATH_MAX
+ * buffers, restored on return. Symlinks are reported, never followed.
+ * With num_threads > 0, that many workers list directories ahead of the
+ * walk, which still visits entries in the same order. With 'sort' set the
+ * entries of each directory come in byte order of their names.
+ */
+static int stbup_walk(char *path, char *name, stbup_walk_fn visit, void *user, int num_threads, int sort)
+{
+    stbup_scan_dir *root = stbup_scan_dir_new(path, strlen(path));
+    if (!root)
+        return 0;
+    stbup_scan scan;
+    stbup_scan_init(&scan, num_threads, sort);
+    int ok = stbup_scan_walk(&scan, root, path, name, visit, user);
+    /* after a failure workers may still hold listings, so they go first */
+    stbup_scan_shutdown(&scan);
+    stbup_scan_dir_free(root);
+    return ok;
+}
+
+/*
+ * Split a directory path into the walk buffers: 'path' without trailing
+ * separators and 'name' set to its last component, which prefixes every
+ * entry in the archive as with "tar cf out.tar dir". A "." or ".." (or a
+ * root) leaves 'name' empty, so entries are stored relative to it.
+ */
+static int stbup_walk_root(const char *dir_path, char *path, char *name)
+{
+    size_t len = strlen(dir_path);
+    while (len > 1 && (dir_path[len - 1] == '/' || dir_path[len - 1] == '\\'))
+        len--;
+    if (len == 0 || len >= STBUP_PATH_MAX)
+        return 0;
+    memcpy(path, dir_path, len);
+    path[len] = 0;
+
+    const char *base = path + len;
+    while (base > path && base[-1] != '/' && base[-1] != '\\')
+        base--;
+    name[0] = 0;
+    if (strcmp(base, ".") != 0 && strcmp(base, "..") != 0 && strcmp(base, "/") != 0)
+        memcpy(name, base, strlen(base) + 1);
+    return 1;
+}
+
+/* ============================================================
+   TAR creator
+   ============================================================ */
+
+/* User or group name of one id, as stored in TAR headers; empty when the id has none */
+typedef struct
+{
+    uint64_t id;
+    char name[32];
+} stbup_owner_name;
+
+typedef struct
+{
+    stbup_owner_name *items;
+    size_t count, cap;
+} stbup_owner_list;
+
+/*
+ * Names of the owners met while creating one archive. Each uid and gid is
+ * looked up once, with the reentrant getpwuid_r/getgrgid_r, since with
+ * NSS backed by a directory service every lookup can be a network round
+ * trip.
+ */
+typedef struct
+{
+    stbup_owner_list users;
+    stbup_owner_list groups;
+    int numeric; /* 1: no lookups, uname and gname stay empty */
+} stbup_owner_cache;
+
+/* Where created archive bytes go: a plain file or a compressor in front of one */
+typedef struct
+{
+    int (*write)(void *user, const void *data, size_t size); /* 0 on failure */
+    void *user;
+    FILE *file; /* set when 'user' writes straight to this file: payloads can then skip the buffers */
+    stbup_owner_cache owners;
+    int reproducible;   /* owners 0, holes stored as data, mtimes clamped to mtime_max */
+    uint64_t mtime_max;
+} stbup_tar_writer;
+
+/*
+ * Latest mtime of a reproducible archive: the option if set, else the
+ * SOURCE_DATE_EPOCH convention of reproducible builds, else 0, so that
+ * every member gets the same time whenever its files were checked out.
+ */
+static uint64_t stbup_source_date_epoch(const stbup_create_options *opts)
+{
+    if (opts->source_date_epoch > 0)
+        return (uint64_t)opts->source_date_epoch;
+    const char *env = getenv("SOURCE_DATE_EPOCH");
+    uint64_t v = 0;
+    size_t used = 0;
+    if (env && stbup_parse_decimal(env, strlen(env), &v, &used) && used == strlen(env))
+        return v;
+    return 0;
+}
+
+/* 'file' is the FILE that 'user' writes to unchanged, or NULL */
+static void stbup_tar_writer_init(stbup_tar_writer *w, int (*write)(void *, const void *, size_t),
+                                  void *user, FILE *file, const stbup_create_options *opts)
+{
+    memset(w, 0, sizeof(*w));
+    w->write = write;
+    w->user = user;
+    w->file = file;
+    w->owners.numeric = opts && (opts->numeric_owner || opts->reproducible);
+    w->reproducible = opts && opts->reproducible;
+    if (w->reproducible)
+        w->mtime_max = stbup_source_date_epoch(opts);
+}
+
+static void stbup_tar_writer_free(stbup_tar_writer *w)
+{
+    free(w->owners.users.items);
+    free(w->owners.groups.items);
+}
+
+static int stbup_tar_put(stbup_tar_writer *w, const void *data, size_t size)
+{
+    return size == 0 || w->write(w->user, data, size);
+}
+
+static int stbup_tar_write_stdio(void *user, const void *data, size_t size)
+{
+    return fwrite(data, 1, size, (FILE *)user) == size;
+}
+
+#if STBUP_USE_COPY_RANGE
+/*
+ * Move 'size' bytes at 'src_offset' in src_fd into a plain file archive in
+ * the kernel, so payloads are neither read into user space nor copied
+ * through the stdio buffer. Sets 'moved' to how many bytes went this way
+ * (none for other writers); the caller writes the rest itself.
+ */
+static int stbup_tar_put_fd(stbup_tar_writer *out, int src_fd, uint64_t src_offset, uint64_t size,
+                            uint64_t *moved)
+{
+    *moved = 0;
+    if (!out->file || size < STBUP_STREAM_CHUNK)
+        return 1; /* small payloads are cheaper to keep in the stdio buffer next to their header */
+    if (fflush(out->file) != 0)
+        return 0;
+    *moved = stbup_fd_copy(fileno(out->file), src_fd, src_offset, size);
+    /* the descriptor moved on underneath the stream; the archive only grows at its end */
+    return *moved == 0 || fseeko(out->file, 0, SEEK_END) == 0;
+}
+#endif
 
-        uint64_t size = stbup_octal_to_u64(h->size, sizeof(h->size));
+/* Fill in the size and checksum of a header and write it as one 512-byte block */
+static int stbup_tar_write_header(stbup_tar_writer *out, stbup_tar_header *h, uint64_t size)
+{
+    stbup_u64_to_octal(h->size, sizeof(h->size), size);
+
+    /* Checksum field: 6 octal digits + null + space (8 bytes total) */
+    char chksum_str[8];
+    snprintf(chksum_str, sizeof(chksum_str), "%06o", stbup_tar_checksum(h));
+    memcpy(h->chksum, chksum_str, 6);
+    h->chksum[6] = 0;
+    h->chksum[7] = ' ';
 
-        /* trim trailing spaces/null from name and prefix */
-        char name[101];
-        char prefix[156];
-        size_t name_len = 0;
-        size_t prefix_len = 0;
+    /* TAR header struct is 500 bytes, need 12 bytes padding to make 512 */
+    char padding[12] = { 0 };
+    return stbup_tar_put(out, h, sizeof(*h)) && stbup_tar_put(out, padding, sizeof(padding));
+}
 
-        for (int i = 0; i < 100 && h->name[i] && h->name[i] != ' '; i++)
-            name[name_len++] = h->name[i];
-        name[name_len] = 0;
+/* Zero-fill the last block of a member holding size bytes */
+static int stbup_tar_write_padding(stbup_tar_writer *out, uint64_t size)
+{
+    size_t pad = (size_t)((512 - (size % 512)) % 512);
+    char zeros[512] = { 0 };
+    return stbup_tar_put(out, zeros, pad);
+}
 
-        for (int i = 0; i < 155 && h->prefix[i] && h->prefix[i] != ' '; i++)
-            prefix[prefix_len++] = h->prefix[i];
-        prefix[prefix_len] = 0;
+/* Append a "len key=value\n" PAX record, where len counts the whole record */
+static int stbup_tar_pax_append(char *buf, size_t cap, size_t *len, const char *key,
+                                const char *value)
+{
+    size_t body = strlen(key) + strlen(value) + 3; /* space, '=', newline */
+    size_t total = body + 1;
+    while (total != body + (size_t)snprintf(NULL, 0, "%zu", total))
+        total++;
+    if (total >= cap - *len)
+        return 0;
+    snprintf(buf + *len, cap - *len, "%zu %s=%s\n", total, key, value);
+    *len += total;
+    return 1;
+}
 
-        if (size > SIZE_MAX)
-            return 0;
+/* Write a PAX extended header holding 'records' for the member 'filename' that follows */
+static int stbup_tar_write_pax(stbup_tar_writer *out, const stbup_tar_header *base,
+                               const char *filename, const char *records, size_t len)
+{
+    /* POSIX magic, so that readers look for the extended header */
+    stbup_tar_header h = *base;
+    memset(h.name, 0, sizeof(h.name));
+    snprintf(h.name, sizeof(h.name), "PaxHeaders/%s", filename);
+    h.typeflag = 'x';
+    memcpy(h.magic, "ustar", 6);
+    memcpy(h.version, "00", 2);
+    return stbup_tar_write_header(out, &h, len) && stbup_tar_put(out, records, len) &&
+           stbup_tar_write_padding(out, len);
+}
 
-        if (size > UINT64_MAX - 511ULL)
-            return 0;
+/*
+ * Members past STBUP_TAR_OCTAL_SIZE_MAX get a PAX size record; their header
+ * has the size in base-256 as well, for readers that only know GNU tar.
+ */
+static int stbup_tar_pax_size(char *buf, size_t cap, size_t *len, uint64_t size)
+{
+    char value[24];
+    if (size <= STBUP_TAR_OCTAL_SIZE_MAX)
+        return 1;
+    snprintf(value, sizeof(value), "%llu", (unsigned long long)size);
+    return stbup_tar_pax_append(buf, cap, len, "size", value);
+}
 
-        uint64_t aligned_size = (size + 511ULL) & ~511ULL;
-        uint64_t total_span = 512ULL + aligned_size;
-        if (total_span > (uint64_t)(end - p))
+#if STBUP_USE_SEEK_HOLE
+/*
+ * Collect the data extents of an open file. Returns 1 when the file has
+ * holes and 0 when it should be stored in full, which includes files on
+ * filesystems without SEEK_DATA. A trailing hole is recorded as an empty
+ * run at the end of the file, like GNU tar does.
+ */
+static int stbup_tar_scan_holes(int fd, uint64_t size, stbup_tar_sparse **map, size_t *count)
+{
+    size_t cap = 16;
+    uint64_t pos = 0;
+    *count = 0;
+    *map = (stbup_tar_sparse *)malloc(cap * sizeof(**map));
+    if (!*map || size == 0)
+        return 0;
+    while (pos < size)
+    {
+        off_t data = lseek(fd, (off_t)pos, SEEK_DATA);
+        if (data < 0 && errno == ENXIO)
+            break; /* only a hole is left */
+        off_t hole = data < 0 ? -1 : lseek(fd, data, SEEK_HOLE);
+        if (hole < 0)
             return 0;
-
-        size_t skip = (size_t)total_span;
-        size_t data_size = (size_t)size;
-
-        if (name_len == 0)
+        if ((uint64_t)data >= size)
+            break;
+        if ((uint64_t)hole > size)
+            hole = (off_t)size; /* the file grew while we were looking */
+        if (*count + 2 > cap) /* keep room for the trailing run */
         {
-            /* advance to next header even if no name */
-            p += skip;
-            continue;
+            stbup_tar_sparse *p = (stbup_tar_sparse *)realloc(*map, 2 * cap * sizeof(*p));
+            if (!p)
+                return 0;
+            *map = p;
+            cap *= 2;
         }
+        (*map)[*count].offset = (uint64_t)data;
+        (*map)[*count].size = (uint64_t)(hole - data);
+        (*count)++;
+        pos = (uint64_t)hole;
+    }
+    if (*count == 1 && (*map)[0].offset == 0 && (*map)[0].size == size)
+        return 0;
+    if (pos < size)
+    {
+        (*map)[*count].offset = size;
+        (*map)[*count].size = 0;
+        (*count)++;
+    }
+    return 1;
+}
 
-        /* Build entry path from prefix and name */
-        char entry_path[STBUP_PATH_MAX];
-        if (prefix_len > 0)
-        {
-            if (snprintf(entry_path, sizeof(entry_path), "%s/%s", prefix, name) >= (int)sizeof(entry_path))
-                return 0; /* Path too long */
-        }
-        else
-        {
-            if (snprintf(entry_path, sizeof(entry_path), "%s", name) >= (int)sizeof(entry_path))
-                return 0; /* Path too long */
-        }
-        
-        /* Normalize path to prevent path traversal attacks */
-        char fullpath[STBUP_PATH_MAX];
-        if (!stbup_normalize_path(entry_path, out_dir, fullpath))
-            return 0; /* Invalid path (path traversal attempt) */
+/*
+ * Store a file with holes as a PAX 1.0 sparse member: an extended header
+ * carrying the real name and size, then a member whose data is the decimal
+ * run map followed by the bytes of each run. Returns 1 when the member was
+ * written, 0 on error and -1 when the file has no holes.
+ */
+static int stbup_tar_create_sparse(stbup_tar_writer *out, const stbup_tar_header *base,
+                                   const char *file_path, const char *filename, uint64_t size)
+{
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0)
+        return 0;
 
-        if (h->typeflag == '5')
+    stbup_tar_sparse *map = NULL;
+    size_t count = 0;
+    if (!stbup_tar_scan_holes(fd, size, &map, &count))
+    {
+        close(fd);
+        free(map);
+        return -1;
+    }
+
+    /* Run map: one decimal per line, padded to a block boundary */
+    size_t map_cap = 21 * (2 * count + 1) + 1;
+    size_t records_cap = strlen(filename) + 256;
+    char *map_text = (char *)malloc(map_cap);
+    char *records = (char *)malloc(records_cap);
+    unsigned char *buf = (unsigned char *)malloc(STBUP_STREAM_CHUNK);
+    size_t map_len = 0;
+    size_t records_len = 0;
+    uint64_t stored = 0;
+    int ok = map_text && records && buf;
+    if (ok)
+    {
+        map_len = (size_t)snprintf(map_text, map_cap, "%zu\n", count);
+        for (size_t i = 0; i < count; i++)
         {
-            /* directory */
-            if (!stbup_mkdirs(fullpath))
-                return 0;
+            map_len += (size_t)snprintf(map_text + map_len, map_cap - map_len, "%llu\n%llu\n",
+                                        (unsigned long long)map[i].offset,
+                                        (unsigned long long)map[i].size);
+            stored += map[i].size;
         }
-        else if (h->typeflag == '0' || h->typeflag == '\0')
+
+        char realsize[24];
+        snprintf(realsize, sizeof(realsize), "%llu", (unsigned long long)size);
+        ok = stbup_tar_pax_append(records, records_cap, &records_len, "GNU.sparse.major", "1") &&
+             stbup_tar_pax_append(records, records_cap, &records_len, "GNU.sparse.minor", "0") &&
+             stbup_tar_pax_append(records, records_cap, &records_len, "GNU.sparse.name", filename) &&
+             stbup_tar_pax_append(records, records_cap, &records_len, "GNU.sparse.realsize", realsize);
+    }
+
+    /* Both members use POSIX magic so readers look for the extended header */
+    uint64_t map_size = (map_len + 511) & ~(uint64_t)511;
+    ok = ok && stbup_tar_pax_size(records, records_cap, &records_len, map_size + stored) &&
+         stbup_tar_write_pax(out, base, filename, records, records_len);
+
+    stbup_tar_header h = *base;
+    memset(h.name, 0, sizeof(h.name));
+    snprintf(h.name, sizeof(h.name), "GNUSparseFile.0/%s", filename);
+    h.typeflag = '0';
+    memcpy(h.magic, "ustar", 6);
+    memcpy(h.version, "00", 2);
+    ok = ok && stbup_tar_write_header(out, &h, map_size + stored) &&
+         stbup_tar_put(out, map_text, map_len) && stbup_tar_write_padding(out, map_len);
+
+    /* Read only the data runs; the holes cost neither reads nor archive space */
+    for (size_t i = 0; ok && i < count; i++)
+    {
+        uint64_t at = map[i].offset;
+        uint64_t left = map[i].size;
+#if STBUP_USE_COPY_RANGE
+        uint64_t moved = 0;
+        ok = stbup_tar_put_fd(out, fd, at, left, &moved);
+        at += moved;
+        left -= moved;
+#endif
+        while (ok && left > 0)
         {
-            /* regular file */
-            char dirpath[STBUP_PATH_MAX];
-            memcpy(dirpath, fullpath, sizeof(dirpath));
-            stbup_dirname(dirpath);
-            if (dirpath[0] && !stbup_mkdirs(dirpath))
-                return 0; /* can't create parent dir */
-            if (!stbup_write_file(fullpath, p + 512, data_size))
-                return 0;
-            files_extracted++;
+            size_t n = left < STBUP_STREAM_CHUNK ? (size_t)left : STBUP_STREAM_CHUNK;
+            ssize_t got = pread(fd, buf, n, (off_t)at);
+            ok = got > 0 && stbup_tar_put(out, buf, (size_t)got);
+            at += (uint64_t)(ok ? got : 0);
+            left -= (uint64_t)(ok ? got : 0);
         }
-
-        /* advance to next header */
-        p += skip;
     }
+    ok = ok && stbup_tar_write_padding(out, stored);
 
-    return files_extracted > 0;
+    close(fd);
+    free(map);
+    free(map_text);
+    free(records);
+    free(buf);
+    return ok;
 }
+#endif
 
-/* ============================================================
-   TAR creator
-   ============================================================ */
-
-static int stbup_read_file(const char *path, void **data, size_t *size)
+/* Copy a user or group name into a header field, truncated to leave a terminator */
+static void stbup_tar_set_owner_name(char *dst, size_t size, const char *name)
 {
-    FILE *f = fopen(path, "rb");
-    if (!f)
-        return 0;
-
-    fseek(f, 0, SEEK_END);
-    long sz = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    size_t len = strlen(name);
+    if (len > size - 1)
+        len = size - 1;
+    memcpy(dst, name, len);
+}
 
-    if (sz < 0)
+#ifndef _WIN32
+/* Ask the system for the name of a user or group id, growing the buffer while it is too small */
+static void stbup_owner_lookup(int group, uint64_t id, char *name, size_t size)
+{
+    size_t cap = 1024;
+    int err = ERANGE;
+    while (err == ERANGE && cap <= ((size_t)1 << 20))
     {
-        fclose(f);
-        return 0;
+        char *buf = (char *)malloc(cap);
+        if (!buf)
+            return;
+        if (group)
+        {
+            struct group g, *found = NULL;
+            err = getgrgid_r((gid_t)id, &g, buf, cap, &found);
+            if (err == 0 && found)
+                stbup_tar_set_owner_name(name, size, found->gr_name);
+        }
+        else
+        {
+            struct passwd pw, *found = NULL;
+            err = getpwuid_r((uid_t)id, &pw, buf, cap, &found);
+            if (err == 0 && found)
+                stbup_tar_set_owner_name(name, size, found->pw_name);
+        }
+        free(buf);
+        cap *= 2;
     }
+}
+#endif
 
-    void *buf = malloc((size_t)sz);
-    if (!buf)
+/* Name of a user (or group) id, looked up on first use; "" when there is none */
+static const char *stbup_owner_name_of(stbup_owner_cache *c, int group, uint64_t id)
+{
+    stbup_owner_list *l = group ? &c->groups : &c->users;
+    for (size_t i = 0; i < l->count; i++)
     {
-        fclose(f);
-        return 0;
+        if (l->items[i].id == id)
+            return l->items[i].name;
     }
-
-    if (fread(buf, 1, (size_t)sz, f) != (size_t)sz)
+    if (l->count == l->cap)
     {
-        free(buf);
-        fclose(f);
-        return 0;
+        size_t cap = l->cap ? 2 * l->cap : 8;
+        stbup_owner_name *p = (stbup_owner_name *)realloc(l->items, cap * sizeof(*p));
+        if (!p)
+            return "";
+        l->items = p;
+        l->cap = cap;
     }
-
-    fclose(f);
-    *data = buf;
-    *size = (size_t)sz;
-    return 1;
+    stbup_owner_name *o = &l->items[l->count++];
+    memset(o, 0, sizeof(*o));
+    o->id = id;
+#ifndef _WIN32
+    stbup_owner_lookup(group, id, o->name, sizeof(o->name));
+#endif
+    return o->name;
 }
 
-/* Create a TAR archive from a single file (equivalent to tar cf) */
-static int stbup_tar_create_file(const char *archive_path, const char *file_path)
+/* Header fields every member takes from its metadata: permissions, owner and time */
+static void stbup_tar_header_init(stbup_tar_writer *out, stbup_tar_header *h, const stbup_stat *st)
 {
-    FILE *out = fopen(archive_path, "wb");
-    if (!out)
-        return 0;
+    uint64_t mtime = (uint64_t)st->st_mtime;
+    if (out->reproducible && mtime > out->mtime_max)
+        mtime = out->mtime_max;
+    memset(h, 0, sizeof(*h));
+    /* just permissions, file type is in typeflag */
+    stbup_u64_to_octal(h->mode, sizeof(h->mode), (uint64_t)(st->st_mode & 0777));
+    stbup_u64_to_octal(h->uid, sizeof(h->uid), out->reproducible ? 0 : (uint64_t)st->st_uid);
+    stbup_u64_to_octal(h->gid, sizeof(h->gid), out->reproducible ? 0 : (uint64_t)st->st_gid);
+    stbup_u64_to_octal(h->mtime, sizeof(h->mtime), mtime);
+    memcpy(h->magic, "ustar", 5); /* "ustar" (5 bytes) */
+    h->magic[5] = ' ';            /* space (6th byte) */
+    h->version[0] = ' ';          /* space (1st byte) */
+    h->version[1] = 0;            /* null (2nd byte) */
 
-    void *file_data = NULL;
-    size_t file_size = 0;
-    if (!stbup_read_file(file_path, &file_data, &file_size))
+    if (!out->owners.numeric)
     {
-        fclose(out);
-        return 0;
+        stbup_tar_set_owner_name(h->uname, sizeof(h->uname),
+                                 stbup_owner_name_of(&out->owners, 0, (uint64_t)st->st_uid));
+        stbup_tar_set_owner_name(h->gname, sizeof(h->gname),
+                                 stbup_owner_name_of(&out->owners, 1, (uint64_t)st->st_gid));
     }
+}
 
-    /* Extract filename from path */
-    const char *filename = file_path;
-    const char *last_slash = strrchr(file_path, '/');
-    const char *last_backslash = strrchr(file_path, '\\');
-    if (last_slash || last_backslash)
-    {
-        const char *last_sep = (last_slash > last_backslash) ? last_slash : last_backslash;
-        filename = last_sep + 1;
-    }
+/*
+ * Copy the data of a regular file into the archive as 'member', in the
+ * kernel where stbup_tar_put_fd can, else through a bounded buffer, so its
+ * size is not limited by memory.
+ */
+static int stbup_tar_add_data(stbup_tar_writer *out, stbup_tar_header *h, const char *path,
+                              const char *member, char *records, size_t records_cap,
+                              size_t records_len)
+{
+    FILE *in = fopen(path, "rb");
+    unsigned char *buf = (unsigned char *)malloc(STBUP_STREAM_CHUNK);
+    uint64_t file_size = 0;
+    int ok = in && buf && stbup_fsize64(in, &file_size) && stbup_fseek64(in, 0) &&
+             stbup_tar_pax_size(records, records_cap, &records_len, file_size) &&
+             (records_len == 0 || stbup_tar_write_pax(out, h, member, records, records_len)) &&
+             stbup_tar_write_header(out, h, file_size);
+    uint64_t done = 0;
+#if STBUP_USE_COPY_RANGE
+    ok = ok && stbup_tar_put_fd(out, fileno(in), 0, file_size, &done) && stbup_fseek64(in, done);
+#endif
+    while (ok && done < file_size)
+    {
+        size_t n = file_size - done < STBUP_STREAM_CHUNK ? (size_t)(file_size - done)
+                                                         : STBUP_STREAM_CHUNK;
+        ok = fread(buf, 1, n, in) == n && stbup_tar_put(out, buf, n);
+        done += n;
+    }
+    ok = ok && stbup_tar_write_padding(out, file_size);
+    if (in)
+        fclose(in);
+    free(buf);
+    return ok;
+}
 
-    size_t name_len = strlen(filename);
-    if (name_len > 100)
-    {
-        /* Use prefix for long names (simplified: just truncate for now) */
-        name_len = 100;
-    }
+/*
+ * Append the member for 'path' to an archive under 'name', described by
+ * 'st'. Directories get a trailing slash and symlinks keep their target;
+ * a name or target that does not fit its header field is carried in a PAX
+ * record. Hard links are stored as separate copies, and sockets, FIFOs
+ * and devices are skipped.
+ */
+static int stbup_tar_add_entry(stbup_tar_writer *out, const char *path, const char *name,
+                               const stbup_stat *st)
+{
+    char member[STBUP_PATH_MAX + 1];
+    char target[STBUP_PATH_MAX];
+    char records[2 * STBUP_PATH_MAX + 128];
+    size_t records_len = 0;
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len >= STBUP_PATH_MAX)
+        return 0;
+    memcpy(member, name, name_len + 1);
 
-    /* Create TAR header */
     stbup_tar_header h;
-    memset(&h, 0, sizeof(h));
-
-    memcpy(h.name, filename, name_len);
-
-    /* Get file stats for mode, uid, gid, mtime */
-    uint64_t mode = 0644;
-    uint64_t uid = 0;
-    uint64_t gid = 0;
-    uint64_t mtime = 0;
-
-#ifdef _WIN32
-    /* On Windows, use default values */
-    struct _stat st;
-    if (_stat(file_path, &st) == 0)
-    {
-        mode = (st.st_mode & 0777) | 0100000; /* regular file with permissions */
-        uid = 0;
-        gid = 0;
-        mtime = (uint64_t)st.st_mtime;
-    }
-    else
-    {
-        mode = 0100644; /* default: regular file, rw-r--r-- */
-    }
-#else
-    struct stat st;
-    if (stat(file_path, &st) == 0)
+    stbup_tar_header_init(out, &h, st);
+    target[0] = 0;
+    if (stbup_stat_is_dir(st))
     {
-        mode = st.st_mode & 0777; /* just permissions, file type is in typeflag */
-        uid = st.st_uid;
-        gid = st.st_gid;
-        mtime = (uint64_t)st.st_mtime;
+        h.typeflag = '5';
+        member[name_len++] = '/';
+        member[name_len] = 0;
     }
-    else
+    else if (stbup_stat_is_file(st))
+        h.typeflag = '0';
+#ifndef _WIN32
+    else if (S_ISLNK(st->st_mode))
     {
-        mode = 0644; /* default: rw-r--r-- */
+        ssize_t n = readlink(path, target, sizeof(target) - 1);
+        if (n <= 0)
+            return 0;
+        target[n] = 0;
+        h.typeflag = '2';
+        memcpy(h.linkname, target, (size_t)n < sizeof(h.linkname) ? (size_t)n : sizeof(h.linkname));
+        if ((size_t)n > sizeof(h.linkname) &&
+            !stbup_tar_pax_append(records, sizeof(records), &records_len, "linkpath", target))
+            return 0;
     }
 #endif
+    else
+        return 1;
 
-    stbup_u64_to_octal(h.mode, sizeof(h.mode), mode);
-    stbup_u64_to_octal(h.uid, sizeof(h.uid), uid);
-    stbup_u64_to_octal(h.gid, sizeof(h.gid), gid);
-    stbup_u64_to_octal(h.size, sizeof(h.size), file_size);
-    stbup_u64_to_octal(h.mtime, sizeof(h.mtime), mtime);
-    h.typeflag = '0';            /* regular file */
-    memcpy(h.magic, "ustar", 5); /* "ustar" (5 bytes) */
-    h.magic[5] = ' ';            /* space (6th byte) */
-    h.version[0] = ' ';          /* space (1st byte) */
-    h.version[1] = 0;            /* null (2nd byte) */
+    memcpy(h.name, member, name_len < sizeof(h.name) ? name_len : sizeof(h.name));
+    if (name_len > sizeof(h.name) &&
+        !stbup_tar_pax_append(records, sizeof(records), &records_len, "path", member))
+        return 0;
 
-    /* Get username and groupname */
-#ifndef _WIN32
-    struct passwd *pw = getpwuid(uid);
-    if (pw)
-    {
-        size_t uname_len = strlen(pw->pw_name);
-        if (uname_len > 31)
-            uname_len = 31;
-        memcpy(h.uname, pw->pw_name, uname_len);
-    }
-    struct group *gr = getgrgid(gid);
-    if (gr)
-    {
-        size_t gname_len = strlen(gr->gr_name);
-        if (gname_len > 31)
-            gname_len = 31;
-        memcpy(h.gname, gr->gr_name, gname_len);
-    }
+    if (h.typeflag != '0')
+        return (records_len == 0 || stbup_tar_write_pax(out, &h, member, records, records_len)) &&
+               stbup_tar_write_header(out, &h, 0);
+
+#if STBUP_USE_SEEK_HOLE
+    /* Files with holes are stored as PAX sparse members holding only their data; where the
+       holes are depends on the filesystem, so reproducible archives store them as zeros */
+    int ok = st->st_size > 0 && !out->reproducible
+                 ? stbup_tar_create_sparse(out, &h, path, member, (uint64_t)st->st_size)
+                 : -1;
+    if (ok >= 0)
+        return ok;
 #endif
+    return stbup_tar_add_data(out, &h, path, member, records, sizeof(records), records_len);
+}
 
-    /* Calculate and write checksum (must be done after other fields are set) */
-    unsigned int checksum = stbup_tar_checksum(&h);
-    /* Checksum field: 6 octal digits + null + space (8 bytes total) */
-    char chksum_str[8];
-    snprintf(chksum_str, sizeof(chksum_str), "%06o", checksum); /* 6 digits */
-    memcpy(h.chksum, chksum_str, 6);
-    h.chksum[6] = 0;   /* null */
-    h.chksum[7] = ' '; /* space */
+/* Two zero blocks mark the end of an archive */
+static int stbup_tar_write_end(stbup_tar_writer *out)
+{
+    char zeros[1024] = { 0 };
+    return stbup_tar_put(out, zeros, sizeof(zeros));
+}
 
-    /* Write header (must be exactly 512 bytes) */
-    /* TAR header struct is 500 bytes, need 12 bytes padding to make 512 */
-    if (fwrite(&h, 1, sizeof(h), out) != sizeof(h))
-    {
-        free(file_data);
-        fclose(out);
-        return 0;
-    }
-    /* Write 12 bytes of zero padding to make header exactly 512 bytes */
-    char padding[12] = { 0 };
-    if (fwrite(padding, 1, 12, out) != 12)
+/* Last component of a path, after either kind of separator */
+static const char *stbup_path_basename(const char *path)
+{
+    const char *filename = path;
+    for (const char *p = path; *p; p++)
     {
-        free(file_data);
-        fclose(out);
-        return 0;
+        if (*p == '/' || *p == '\\')
+            filename = p + 1;
     }
+    return filename;
+}
 
-    /* Write file data */
-    if (fwrite(file_data, 1, file_size, out) != file_size)
-    {
-        free(file_data);
-        fclose(out);
+/* Write the single member for file_path, followed by the end of the archive */
+static int stbup_tar_write_file(stbup_tar_writer *out, const char *file_path)
+{
+    /* follows symlinks, so that a link given by name stores what it points to */
+    stbup_stat st;
+    return stbup_stat_path(file_path, &st) && stbup_stat_is_file(&st) &&
+           stbup_tar_add_entry(out, file_path, stbup_path_basename(file_path), &st) &&
+           stbup_tar_write_end(out);
+}
+
+/* Create a TAR archive from a single file (equivalent to tar cf) */
+static int stbup_tar_create_file_ex(const char *archive_path, const char *file_path,
+                                    const stbup_create_options *opts)
+{
+    FILE *f = fopen(archive_path, "wb");
+    if (!f)
         return 0;
-    }
+    stbup_tar_writer out;
+    stbup_tar_writer_init(&out, stbup_tar_write_stdio, f, f, opts);
+    int ok = stbup_tar_write_file(&out, file_path);
+    stbup_tar_writer_free(&out);
+    return (fclose(f) == 0) && ok;
+}
 
-    /* Pad to 512-byte boundary */
-    size_t pad = (512 - (file_size % 512)) % 512;
-    if (pad > 0)
-    {
-        char zeros[512] = { 0 };
-        if (fwrite(zeros, 1, pad, out) != pad)
-        {
-            free(file_data);
-            fclose(out);
-            return 0;
-        }
-    }
+static int stbup_tar_create_file(const char *archive_path, const char *file_path)
+{
+    return stbup_tar_create_file_ex(archive_path, file_path, NULL);
+}
 
-    /* Write two zero blocks (end of archive) */
-    char zeros[1024] = { 0 };
-    if (fwrite(zeros, 1, 1024, out) != 1024)
-    {
-        free(file_data);
-        fclose(out);
+/* Tree being archived, and the archive itself, which must not end up inside */
+typedef struct
+{
+    stbup_tar_writer *out;
+    stbup_stat self;
+    int has_self;
+} stbup_tar_tree;
+
+/* Is 'st' the archive being written? It may well live in the tree being read */
+static int stbup_walk_is_self(const stbup_stat *self, int has_self, const stbup_stat *st)
+{
+#ifdef _WIN32
+    (void)self;
+    (void)has_self;
+    (void)st;
+    return 0; /* no inode numbers to compare */
+#else
+    return has_self && self->st_dev == st->st_dev && self->st_ino == st->st_ino;
+#endif
+}
+
+static int stbup_tar_tree_visit(void *user, const char *path, const char *name, const stbup_stat *st)
+{
+    stbup_tar_tree *tree = (stbup_tar_tree *)user;
+    if (stbup_walk_is_self(&tree->self, tree->has_self, st))
+        return 1;
+    return stbup_tar_add_entry(tree->out, path, name, st);
+}
+
+/*
+ * Write every member below dir_path, then the end of the archive. The
+ * members are named like "tar cf out.tar dir" names them, under the last
+ * component of dir_path, and parents come before their contents.
+ */
+static int stbup_tar_write_tree(stbup_tar_writer *out, const char *dir_path, const char *archive_path,
+                                const stbup_create_options *opts)
+{
+    char path[STBUP_PATH_MAX];
+    char name[STBUP_PATH_MAX];
+    stbup_stat st;
+    stbup_tar_tree tree;
+    tree.out = out;
+    tree.has_self = stbup_stat_path(archive_path, &tree.self);
+    if (!stbup_walk_root(dir_path, path, name) || !stbup_stat_path(path, &st) || !stbup_stat_is_dir(&st))
         return 0;
-    }
+    return (name[0] == 0 || stbup_tar_add_entry(out, path, name, &st)) &&
+           stbup_walk(path, name, stbup_tar_tree_visit, &tree, opts ? opts->num_threads : 0,
+                      opts && opts->reproducible) &&
+           stbup_tar_write_end(out);
+}
 
-    free(file_data);
-    fclose(out);
-    return 1;
+/* Create a TAR archive from a directory tree (equivalent to tar cf) */
+static int stbup_tar_create_dir_ex(const char *archive_path, const char *dir_path,
+                                   const stbup_create_options *opts)
+{
+    FILE *f = fopen(archive_path, "wb");
+    if (!f)
+        return 0;
+    stbup_tar_writer out;
+    stbup_tar_writer_init(&out, stbup_tar_write_stdio, f, f, opts);
+    int ok = stbup_tar_write_tree(&out, dir_path, archive_path, opts);
+    stbup_tar_writer_free(&out);
+    return (fclose(f) == 0) && ok;
+}
+
+static int stbup_tar_create_dir(const char *archive_path, const char *dir_path)
+{
+    return stbup_tar_create_dir_ex(archive_path, dir_path, NULL);
 }
 
 /* ============================================================
@@ -2524,187 +7742,525 @@ static int stbup_gzip_compress(const void *data, size_t data_size,
 #endif
 
 #if STBUP_HAS_MINIZ
-/* Extract .tar.gz archive */
-static int stbup_targz_extract(const char *archive_path, const char *out_dir)
+/* ============================================================
+   Streaming .tar.gz extraction
+   ============================================================ */
+
+/* Compressed input, either read from a file in STBUP_STREAM_CHUNK pieces or taken from memory */
+typedef struct
+{
+    FILE *f;
+    unsigned char *buf;
+    const unsigned char *next;
+    size_t avail;
+    int eof;
+    uint64_t pos;  /* input offset of 'next' */
+    uint64_t size; /* of a file input, for checkpoints */
+    const struct stat *st; /* of the archive file, NULL for one in memory */
+} stbup_gz_input;
+
+/* Refill an exhausted input buffer; sets eof when nothing more can be read */
+static void stbup_gz_input_fill(stbup_gz_input *in)
+{
+    if (in->avail > 0 || in->eof)
+        return;
+    if (!in->f)
+    {
+        in->eof = 1;
+        return;
+    }
+    in->avail = fread(in->buf, 1, STBUP_STREAM_CHUNK, in->f);
+    in->next = in->buf;
+    if (in->avail == 0)
+        in->eof = 1;
+}
+
+static int stbup_gz_input_byte(stbup_gz_input *in, unsigned char *c)
 {
-    void *compressed_data = NULL;
-    size_t compressed_size = 0;
-    if (!stbup_read_file(archive_path, &compressed_data, &compressed_size))
+    stbup_gz_input_fill(in);
+    if (in->avail == 0)
         return 0;
+    *c = *in->next++;
+    in->avail--;
+    in->pos++;
+    return 1;
+}
 
-    void *tar_data = NULL;
-    size_t tar_size = 0;
-    if (!stbup_gzip_decompress(compressed_data, compressed_size, &tar_data, &tar_size))
+static int stbup_gz_input_skip(stbup_gz_input *in, size_t n)
+{
+    unsigned char c;
+    while (n--)
     {
-        free(compressed_data);
-        return 0;
+        if (!stbup_gz_input_byte(in, &c))
+            return 0;
     }
+    return 1;
+}
 
-    int ret = stbup_tar_extract_stream(tar_data, tar_size, out_dir);
-    free(compressed_data);
-    free(tar_data);
-    return ret;
+/* Continue reading at input offset 'pos' */
+static int stbup_gz_input_seek(stbup_gz_input *in, uint64_t pos)
+{
+    if (!in->f)
+    {
+        uint64_t end = in->pos + in->avail;
+        if (pos > end)
+            return 0;
+        in->next = pos >= in->pos ? in->next + (size_t)(pos - in->pos)
+                                  : in->next - (size_t)(in->pos - pos);
+        in->avail = (size_t)(end - pos);
+    }
+    else
+    {
+        if (!stbup_fseek64(in->f, pos))
+            return 0;
+        in->avail = 0;
+        in->eof = 0;
+    }
+    in->pos = pos;
+    return 1;
+}
+
+/* Consume the gzip member header (RFC 1952), leaving the input at the deflate data */
+static int stbup_gz_read_header(stbup_gz_input *in)
+{
+    unsigned char hdr[10];
+    for (int i = 0; i < 10; i++)
+    {
+        if (!stbup_gz_input_byte(in, &hdr[i]))
+            return 0;
+    }
+    if (hdr[0] != 0x1f || hdr[1] != 0x8b || hdr[2] != 8)
+        return 0; /* Not a gzip file */
+
+    unsigned char c;
+    if (hdr[3] & 0x04)
+    { /* FEXTRA */
+        unsigned char lo, hi;
+        if (!stbup_gz_input_byte(in, &lo) || !stbup_gz_input_byte(in, &hi))
+            return 0;
+        if (!stbup_gz_input_skip(in, (size_t)lo | ((size_t)hi << 8)))
+            return 0;
+    }
+    if (hdr[3] & 0x08)
+    { /* FNAME */
+        do
+        {
+            if (!stbup_gz_input_byte(in, &c))
+                return 0;
+        } while (c != 0);
+    }
+    if (hdr[3] & 0x10)
+    { /* FCOMMENT */
+        do
+        {
+            if (!stbup_gz_input_byte(in, &c))
+                return 0;
+        } while (c != 0);
+    }
+    if (hdr[3] & 0x02)
+    { /* FHCRC */
+        if (!stbup_gz_input_skip(in, 2))
+            return 0;
+    }
+    return 1;
 }
 
-/* Create .tar.gz archive from a file */
-static int stbup_targz_create_file(const char *archive_path, const char *file_path)
+/* Inflater state: decompressor plus the 32KB ring that doubles as the LZ dictionary */
+typedef struct
 {
-    /* First create a temporary .tar file in memory instead of on disk */
-    /* We'll create the TAR in memory, then compress it */
+    tinfl_decompressor decomp;
+    unsigned char ring[TINFL_LZ_DICT_SIZE];
+} stbup_gz_inflater;
 
-    void *file_data = NULL;
-    size_t file_size = 0;
-    if (!stbup_read_file(file_path, &file_data, &file_size))
+/*
+ * Inflate a gzip stream and push the output through the TAR parser as it is
+ * produced. Peak memory is one input chunk plus the inflater, whatever the
+ * archive size. The gzip footer (CRC32 and size) is verified at the end.
+ */
+static int stbup_targz_extract_input(stbup_gz_input *in, const char *out_dir,
+                                     const stbup_extract_options *opts)
+{
+    stbup_gz_inflater *inf = (stbup_gz_inflater *)malloc(sizeof(stbup_gz_inflater));
+    if (!inf)
         return 0;
 
-    /* Extract filename from path */
-    const char *filename = file_path;
-    const char *last_slash = strrchr(file_path, '/');
-    const char *last_backslash = strrchr(file_path, '\\');
-    if (last_slash || last_backslash)
+    stbup_tar_stream tar;
+    stbup_tar_stream_init_ex(&tar, out_dir, opts);
+
+    /* inflate progress; a checkpoint stores it together with the raw inflater */
+    stbup_checkpoint_gz gz;
+    memset(&gz, 0, sizeof(gz));
+    gz.state = inf;
+    gz.state_size = sizeof(*inf);
+    gz.crc = MZ_CRC32_INIT;
+
+    int resumed = 0;
+    if (tar.checkpoint)
     {
-        const char *last_sep = (last_slash > last_backslash) ? last_slash : last_backslash;
-        filename = last_sep + 1;
+        stbup_gz_input_fill(in);
+        tar.input_size = in->f ? in->size : in->avail;
+        tar.input_id = stbup_checkpoint_id(in->next, in->avail);
+        if (in->f)
+            tar.input_file = in->f;
+        else
+            tar.input_data = in->next;
+        if (in->st)
+            stbup_checkpoint_file(&tar, in->st);
+        tar.checkpoint_gz = &gz;
+        resumed = stbup_tar_stream_resume(&tar);
     }
 
-    size_t name_len = strlen(filename);
-    if (name_len > 100)
-        name_len = 100;
-
-    /* Calculate TAR size: header (512) + data (padded to 512) + 2 zero blocks (1024) */
-    size_t tar_data_size = 512 + ((file_size + 511) & ~511) + 1024;
-    void *tar_data = malloc(tar_data_size);
-    if (!tar_data)
+    int ok = resumed >= 0;
+    if (resumed > 0)
     {
-        free(file_data);
-        return 0;
+        /* output between the recorded boundary and the end of the last inflate call is in the ring */
+        size_t end = gz.ring_ofs ? (size_t)gz.ring_ofs : TINFL_LZ_DICT_SIZE;
+        uint64_t pending = gz.total_out - tar.offset;
+        ok = gz.total_out >= tar.offset && gz.ring_ofs < TINFL_LZ_DICT_SIZE && pending <= end &&
+             stbup_gz_input_seek(in, gz.input_pos) &&
+             stbup_tar_stream_feed(&tar, inf->ring + end - (size_t)pending, (size_t)pending);
     }
+    else
+    {
+        tinfl_init(&inf->decomp);
+        ok = ok && stbup_gz_read_header(in);
+    }
+
+    while (ok)
+    {
+        stbup_gz_input_fill(in);
+
+        size_t in_bytes = in->avail;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - (size_t)gz.ring_ofs;
+        tinfl_status status = tinfl_decompress(&inf->decomp, in->next, &in_bytes,
+                                               inf->ring, inf->ring + gz.ring_ofs, &out_bytes,
+                                               in->eof ? 0 : TINFL_FLAG_HAS_MORE_INPUT);
+        in->next += in_bytes;
+        in->avail -= in_bytes;
+        in->pos += in_bytes;
+        gz.input_pos = in->pos;
 
-    unsigned char *p = (unsigned char *)tar_data;
-    memset(p, 0, tar_data_size);
+        if (out_bytes > 0)
+        {
+            const unsigned char *out = inf->ring + gz.ring_ofs;
+            gz.crc = (uint32_t)mz_crc32(gz.crc, out, out_bytes);
+            gz.total_out += out_bytes;
+            gz.ring_ofs = (gz.ring_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+            if (!stbup_tar_stream_feed(&tar, out, out_bytes))
+            {
+                ok = 0;
+                break;
+            }
+        }
 
-    /* Create TAR header (same as stbup_tar_create_file) */
-    stbup_tar_header *h = (stbup_tar_header *)p;
-    memcpy(h->name, filename, name_len);
+        if (status == TINFL_STATUS_DONE)
+            break;
+        if (status < TINFL_STATUS_DONE)
+        {
+            ok = 0; /* corrupt or truncated deflate data */
+            break;
+        }
+    }
+    free(inf);
 
-    /* Get file stats */
-    uint64_t mode = 0644;
-    uint64_t uid = 0;
-    uint64_t gid = 0;
-    uint64_t mtime = 0;
+    /* Validate gzip footer: CRC32 and original size */
+    unsigned char footer[8];
+    for (int i = 0; ok && i < 8; i++)
+        ok = stbup_gz_input_byte(in, &footer[i]);
 
-#ifdef _WIN32
-    struct _stat st;
-    if (_stat(file_path, &st) == 0)
+    if (ok)
     {
-        mode = (st.st_mode & 0777) | 0100000;
-        mtime = (uint64_t)st.st_mtime;
+        uint32_t stored_crc32 = (uint32_t)footer[0] | ((uint32_t)footer[1] << 8) |
+                                ((uint32_t)footer[2] << 16) | ((uint32_t)footer[3] << 24);
+        uint32_t stored_size = (uint32_t)footer[4] | ((uint32_t)footer[5] << 8) |
+                               ((uint32_t)footer[6] << 16) | ((uint32_t)footer[7] << 24);
+        if (gz.crc != stored_crc32 || (uint32_t)(gz.total_out & 0xffffffffu) != stored_size)
+            ok = 0; /* data corruption or tampering */
     }
-#else
-    struct stat st;
-    if (stat(file_path, &st) == 0)
+
+    if (!ok)
     {
-        mode = st.st_mode & 0777;
-        uid = st.st_uid;
-        gid = st.st_gid;
-        mtime = (uint64_t)st.st_mtime;
+        stbup_tar_stream_fail(&tar);
+        return 0;
     }
-#endif
+    return stbup_tar_stream_finish(&tar);
+}
 
-    stbup_u64_to_octal(h->mode, sizeof(h->mode), mode);
-    stbup_u64_to_octal(h->uid, sizeof(h->uid), uid);
-    stbup_u64_to_octal(h->gid, sizeof(h->gid), gid);
-    stbup_u64_to_octal(h->size, sizeof(h->size), file_size);
-    stbup_u64_to_octal(h->mtime, sizeof(h->mtime), mtime);
-    h->typeflag = '0';
-    memcpy(h->magic, "ustar", 5);
-    h->magic[5] = ' ';
-    h->version[0] = ' ';
-    h->version[1] = 0;
+/*
+ * Extract .tar.gz archive, streaming it through a bounded buffer. The
+ * compressed file is inflated straight from a memory mapping when possible,
+ * otherwise it is read in STBUP_STREAM_CHUNK pieces.
+ */
+static int stbup_targz_extract_ex(const char *archive_path, const char *out_dir,
+                                  const stbup_extract_options *opts)
+{
+    stbup_gz_input in;
+    memset(&in, 0, sizeof(in));
+    struct stat st;
+    if (stat(archive_path, &st) == 0)
+    {
+        in.size = (uint64_t)st.st_size;
+        in.st = &st;
+    }
 
-#ifndef _WIN32
-    struct passwd *pw = getpwuid(uid);
-    if (pw)
+    stbup_file_view v;
+    if (stbup_file_view_map(&v, archive_path))
     {
-        size_t uname_len = strlen(pw->pw_name);
-        if (uname_len > 31)
-            uname_len = 31;
-        memcpy(h->uname, pw->pw_name, uname_len);
+        in.next = (const unsigned char *)v.data;
+        in.avail = v.size;
+        in.eof = 1;
+        int ret = stbup_targz_extract_input(&in, out_dir, opts);
+        stbup_file_view_close(&v);
+        return ret;
     }
-    struct group *gr = getgrgid(gid);
-    if (gr)
+
+    FILE *f = fopen(archive_path, "rb");
+    if (!f)
+        return 0;
+    in.f = f;
+    in.buf = (unsigned char *)malloc(STBUP_STREAM_CHUNK);
+    if (!in.buf)
     {
-        size_t gname_len = strlen(gr->gr_name);
-        if (gname_len > 31)
-            gname_len = 31;
-        memcpy(h->gname, gr->gr_name, gname_len);
+        fclose(f);
+        return 0;
     }
-#endif
 
-    /* Calculate and write checksum */
-    unsigned int checksum = stbup_tar_checksum(h);
-    char chksum_str[8];
-    snprintf(chksum_str, sizeof(chksum_str), "%06o", checksum);
-    memcpy(h->chksum, chksum_str, 6);
-    h->chksum[6] = 0;
-    h->chksum[7] = ' ';
+    int ret = stbup_targz_extract_input(&in, out_dir, opts);
+    free(in.buf);
+    fclose(f);
+    return ret;
+}
+
+static int stbup_targz_extract(const char *archive_path, const char *out_dir)
+{
+    return stbup_targz_extract_ex(archive_path, out_dir, NULL);
+}
+
+/* Extract a .tar.gz held in memory, inflating straight from the caller's buffer */
+static int stbup_targz_extract_mem_ex(const void *gz_data, size_t gz_size, const char *out_dir,
+                                      const stbup_extract_options *opts)
+{
+    stbup_gz_input in;
+    memset(&in, 0, sizeof(in));
+    in.next = (const unsigned char *)gz_data;
+    in.avail = gz_size;
+    in.eof = 1;
+    return stbup_targz_extract_input(&in, out_dir, opts);
+}
 
-    /* Write file data */
-    memcpy(p + 512, file_data, file_size);
+static int stbup_targz_extract_mem(const void *gz_data, size_t gz_size, const char *out_dir)
+{
+    return stbup_targz_extract_mem_ex(gz_data, gz_size, out_dir, NULL);
+}
 
-    /* Calculate actual TAR size (up to end of data + padding + 2 zero blocks) */
-    size_t actual_tar_size = 512 + ((file_size + 511) & ~511) + 1024;
+/* gzip member being written in STBUP_STREAM_CHUNK pieces, for archives that do not fit in memory */
+typedef struct
+{
+    FILE *f;
+    z_stream strm;
+    unsigned char *buf;
+    mz_ulong crc;
+    uint64_t size;
+} stbup_gz_writer;
 
-    /* Compress TAR data to gzip */
-    void *compressed_data = NULL;
-    size_t compressed_size = 0;
-    if (!stbup_gzip_compress(tar_data, actual_tar_size, &compressed_data, &compressed_size))
+/* Header as stbup_gzip_compress writes it: no name, mtime 0, OS Unix */
+static int stbup_gz_writer_open(stbup_gz_writer *w, const char *path)
+{
+    static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+    memset(w, 0, sizeof(*w));
+    w->crc = crc32(0L, Z_NULL, 0);
+    w->buf = (unsigned char *)malloc(STBUP_STREAM_CHUNK);
+    if (!w->buf)
+        return 0;
+    if (deflateInit2(&w->strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
     {
-        free(tar_data);
-        free(file_data);
+        free(w->buf);
         return 0;
     }
-
-    /* Write compressed data */
-    FILE *out = fopen(archive_path, "wb");
-    if (!out)
+    w->f = fopen(path, "wb");
+    if (!w->f || fwrite(header, 1, sizeof(header), w->f) != sizeof(header))
     {
-        free(tar_data);
-        free(file_data);
-        free(compressed_data);
+        if (w->f)
+            fclose(w->f);
+        deflateEnd(&w->strm);
+        free(w->buf);
         return 0;
     }
+    return 1;
+}
 
-    int ret = (fwrite(compressed_data, 1, compressed_size, out) == compressed_size);
-    fclose(out);
-
-    free(tar_data);
-    free(file_data);
-    free(compressed_data);
-    return ret;
+/* Run deflate over what is queued in the stream, writing out each full buffer */
+static int stbup_gz_writer_deflate(stbup_gz_writer *w, int flush)
+{
+    for (;;)
+    {
+        w->strm.next_out = w->buf;
+        w->strm.avail_out = STBUP_STREAM_CHUNK;
+        int ret = deflate(&w->strm, flush);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            return 0;
+        size_t n = STBUP_STREAM_CHUNK - w->strm.avail_out;
+        if (n && fwrite(w->buf, 1, n, w->f) != n)
+            return 0;
+        if (flush == Z_FINISH ? ret == Z_STREAM_END : w->strm.avail_out != 0)
+            return 1;
+    }
 }
 
-/* Extract .zip archive */
-static int stbup_zip_extract(const char *archive_path, const char *out_dir)
+/* stbup_tar_writer callback */
+static int stbup_gz_writer_write(void *user, const void *data, size_t size)
 {
-    mz_zip_archive zip_archive;
-    memset(&zip_archive, 0, sizeof(zip_archive));
+    stbup_gz_writer *w = (stbup_gz_writer *)user;
+    const unsigned char *p = (const unsigned char *)data;
+    while (size > 0)
+    {
+        /* avail_in is 32 bits wide */
+        size_t n = size < STBUP_STREAM_CHUNK ? size : STBUP_STREAM_CHUNK;
+        w->crc = crc32(w->crc, p, (mz_uint)n);
+        w->size += n;
+        w->strm.next_in = p;
+        w->strm.avail_in = (mz_uint)n;
+        if (!stbup_gz_writer_deflate(w, Z_NO_FLUSH))
+            return 0;
+        p += n;
+        size -= n;
+    }
+    return 1;
+}
 
-    /* Initialize ZIP reader */
-    if (!mz_zip_reader_init_file(&zip_archive, archive_path, 0))
+/* Finish the stream and write the footer; with ok == 0 it only releases everything */
+static int stbup_gz_writer_close(stbup_gz_writer *w, int ok)
+{
+    unsigned char footer[8];
+    for (int i = 0; i < 4; i++)
     {
-        return 0;
+        footer[i] = (unsigned char)((w->crc >> (8 * i)) & 0xff);
+        footer[4 + i] = (unsigned char)((w->size >> (8 * i)) & 0xff); /* ISIZE: size mod 2^32 */
     }
+    ok = ok && stbup_gz_writer_deflate(w, Z_FINISH) &&
+         fwrite(footer, 1, sizeof(footer), w->f) == sizeof(footer);
+    deflateEnd(&w->strm);
+    free(w->buf);
+    return (fclose(w->f) == 0) && ok;
+}
+
+/* Create .tar.gz archive from a file */
+static int stbup_targz_create_file_ex(const char *archive_path, const char *file_path,
+                                      const stbup_create_options *opts)
+{
+    stbup_gz_writer gz;
+    if (!stbup_gz_writer_open(&gz, archive_path))
+        return 0;
+    stbup_tar_writer out;
+    stbup_tar_writer_init(&out, stbup_gz_writer_write, &gz, NULL, opts);
+    int ok = stbup_tar_write_file(&out, file_path);
+    stbup_tar_writer_free(&out);
+    return stbup_gz_writer_close(&gz, ok);
+}
+
+static int stbup_targz_create_file(const char *archive_path, const char *file_path)
+{
+    return stbup_targz_create_file_ex(archive_path, file_path, NULL);
+}
+
+/* Create .tar.gz archive from a directory tree (equivalent to tar czf) */
+static int stbup_targz_create_dir_ex(const char *archive_path, const char *dir_path,
+                                     const stbup_create_options *opts)
+{
+    stbup_gz_writer gz;
+    if (!stbup_gz_writer_open(&gz, archive_path))
+        return 0;
+    stbup_tar_writer out;
+    stbup_tar_writer_init(&out, stbup_gz_writer_write, &gz, NULL, opts);
+    int ok = stbup_tar_write_tree(&out, dir_path, archive_path, opts);
+    stbup_tar_writer_free(&out);
+    return stbup_gz_writer_close(&gz, ok);
+}
+
+static int stbup_targz_create_dir(const char *archive_path, const char *dir_path)
+{
+    return stbup_targz_create_dir_ex(archive_path, dir_path, NULL);
+}
+
+/* Modification time of a ZIP entry from its DOS date and time (local time), or -1 */
+static int64_t stbup_zip_entry_mtime(mz_zip_archive *zip, const mz_zip_archive_file_stat *st)
+{
+    /* the stat struct goes without it here (MINIZ_NO_TIME), so read the central directory */
+    unsigned char b[4];
+    mz_uint64 ofs = zip->m_central_directory_file_ofs + st->m_central_dir_ofs + 12;
+    if (zip->m_pRead(zip->m_pIO_opaque, ofs, b, 4) != 4)
+        return -1;
+    int dos_time = b[0] | (b[1] << 8);
+    int dos_date = b[2] | (b[3] << 8);
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_isdst = -1;
+    tm.tm_year = ((dos_date >> 9) & 127) + 1980 - 1900;
+    tm.tm_mon = ((dos_date >> 5) & 15) - 1;
+    tm.tm_mday = dos_date & 31;
+    tm.tm_hour = (dos_time >> 11) & 31;
+    tm.tm_min = (dos_time >> 5) & 63;
+    tm.tm_sec = (dos_time << 1) & 62;
+    time_t t = mktime(&tm);
+    return t == (time_t)-1 ? -1 : (int64_t)t;
+}
+
+/* Does the file at 'rel' already hold 'size' bytes with this CRC-32? */
+static int stbup_zip_crc_matches(stbup_out *o, const char *rel, uint64_t size, mz_uint32 crc)
+{
+    struct stat st;
+    if (!stbup_out_stat(o, rel, &st) || (st.st_mode & S_IFMT) != S_IFREG ||
+        (uint64_t)st.st_size != size)
+        return 0;
+
+    char full[STBUP_PATH_MAX];
+    if (!stbup_path_join(full, sizeof(full), o->dir, rel))
+        return 0;
+    FILE *f = fopen(full, "rb");
+    if (!f)
+        return 0;
+    unsigned char *buf = (unsigned char *)malloc(STBUP_STREAM_CHUNK);
+    mz_ulong c = MZ_CRC32_INIT;
+    size_t n;
+    while (buf && (n = fread(buf, 1, STBUP_STREAM_CHUNK, f)) > 0)
+        c = mz_crc32(c, buf, n);
+    int ok = buf && !ferror(f) && c == crc;
+    free(buf);
+    fclose(f);
+    return ok;
+}
 
+/* mz_zip_reader_extract_to_callback target passing inflated bytes to a sink */
+static size_t stbup_zip_sink_write(void *opaque, mz_uint64 file_ofs, const void *buf, size_t n)
+{
+    const stbup_sink *sink = (const stbup_sink *)opaque;
+    (void)file_ofs; /* always sequential */
+    return sink->write(sink->user, buf, n) ? n : 0;
+}
+
+/*
+ * Extract every entry of an initialized reader, then end it. Entries
+ * rejected by the options' filter are never inflated, and neither are
+ * entries that update mode finds up to date.
+ */
+static int stbup_zip_extract_reader(mz_zip_archive *zip, const char *out_dir,
+                                    const stbup_extract_options *opts)
+{
     /* Get number of files */
-    mz_uint num_files = mz_zip_reader_get_num_files(&zip_archive);
+    mz_uint num_files = mz_zip_reader_get_num_files(zip);
     int success = 1;
+    stbup_out out;
+    stbup_out_init(&out, out_dir);
+    if (opts && opts->durable)
+        stbup_out_durable(&out, opts->num_threads > 1 ? opts->num_threads : STBUP_SYNC_THREADS);
+    const stbup_sink *sink = opts ? opts->sink : NULL;
 
     /* Extract each file */
     for (mz_uint i = 0; i < num_files; i++)
     {
         mz_zip_archive_file_stat file_stat;
-        if (!mz_zip_reader_file_stat(&zip_archive, i, &file_stat))
+        if (!mz_zip_reader_file_stat(zip, i, &file_stat))
         {
             success = 0;
             break;
@@ -2712,16 +8268,34 @@ static int stbup_zip_extract(const char *archive_path, const char *out_dir)
 
         /* Normalize and validate path to prevent path traversal attacks */
         char normalized_path[STBUP_PATH_MAX];
-        if (!stbup_normalize_path(file_stat.m_filename, out_dir, normalized_path))
+        if (!stbup_entry_path(file_stat.m_filename, normalized_path))
         {
             success = 0;
             break;
         }
+        if (!stbup_filter_accepts(opts, normalized_path))
+            continue;
+
+        if (sink)
+        {
+            /* streamed through inflate into the sink, without a heap copy of the entry */
+            if (mz_zip_reader_is_file_a_directory(zip, i))
+                success = sink->mkdir(sink->user, normalized_path);
+            else
+                success = sink->begin(sink->user, normalized_path, file_stat.m_uncomp_size,
+                                      stbup_zip_entry_mtime(zip, &file_stat)) &&
+                          mz_zip_reader_extract_to_callback(zip, i, stbup_zip_sink_write,
+                                                            (void *)sink, 0) &&
+                          sink->end(sink->user);
+            if (!success)
+                break;
+            continue;
+        }
 
         /* Skip directories */
-        if (mz_zip_reader_is_file_a_directory(&zip_archive, i))
+        if (mz_zip_reader_is_file_a_directory(zip, i))
         {
-            if (!stbup_mkdirs(normalized_path))
+            if (!stbup_out_mkdirs(&out, normalized_path))
             {
                 success = 0;
                 break;
@@ -2729,26 +8303,33 @@ static int stbup_zip_extract(const char *archive_path, const char *out_dir)
             continue;
         }
 
-        /* Extract file to memory */
-        size_t uncomp_size = 0;
-        void *p = mz_zip_reader_extract_to_heap(&zip_archive, i, &uncomp_size, 0);
-        if (!p)
+        int64_t mtime = -1;
+        if (opts && opts->update)
         {
-            success = 0;
-            break;
+            mtime = stbup_zip_entry_mtime(zip, &file_stat);
+            if (stbup_out_unchanged(&out, normalized_path, file_stat.m_uncomp_size, mtime))
+                continue;
+            if (opts->update_crc &&
+                stbup_zip_crc_matches(&out, normalized_path, file_stat.m_uncomp_size,
+                                      file_stat.m_crc32))
+            {
+                /* same bytes, other mtime: fix the stamp so the next run only needs a stat */
+                if (mtime >= 0)
+                    stbup_out_set_mtime(&out, normalized_path, mtime);
+                continue;
+            }
         }
 
-        char dir_path[STBUP_PATH_MAX];
-        memcpy(dir_path, normalized_path, sizeof(dir_path));
-        stbup_dirname(dir_path);
-        if (dir_path[0] && !stbup_mkdirs(dir_path))
+        /* Extract file to memory */
+        size_t uncomp_size = 0;
+        void *p = mz_zip_reader_extract_to_heap(zip, i, &uncomp_size, 0);
+        if (!p)
         {
-            mz_free(p);
             success = 0;
             break;
         }
 
-        if (!stbup_write_file(normalized_path, p, uncomp_size))
+        if (!stbup_out_write_file(&out, normalized_path, 1, -1, 0, p, uncomp_size, mtime))
         {
             mz_free(p);
             success = 0;
@@ -2758,54 +8339,152 @@ static int stbup_zip_extract(const char *archive_path, const char *out_dir)
         mz_free(p);
     }
 
-    mz_zip_reader_end(&zip_archive);
+    if (success && !stbup_out_commit(&out))
+        success = 0;
+    stbup_out_free(&out);
+    mz_zip_reader_end(zip);
     return success;
 }
 
-/* Create .zip archive from a file */
-static int stbup_zip_create_file(const char *archive_path, const char *file_path)
+static int stbup_zip_extract_ex(const char *archive_path, const char *out_dir,
+                                const stbup_extract_options *opts)
+{
+    mz_zip_archive zip_archive;
+    memset(&zip_archive, 0, sizeof(zip_archive));
+    if (!mz_zip_reader_init_file(&zip_archive, archive_path, 0))
+        return 0;
+    return stbup_zip_extract_reader(&zip_archive, out_dir, opts);
+}
+
+static int stbup_zip_extract(const char *archive_path, const char *out_dir)
 {
-    void *file_data = NULL;
-    size_t file_size = 0;
-    if (!stbup_read_file(file_path, &file_data, &file_size))
+    return stbup_zip_extract_ex(archive_path, out_dir, NULL);
+}
+
+/* Extract a ZIP archive held in memory, reading entries from the caller's buffer */
+static int stbup_zip_extract_mem_ex(const void *zip_data, size_t zip_size, const char *out_dir,
+                                    const stbup_extract_options *opts)
+{
+    mz_zip_archive zip_archive;
+    memset(&zip_archive, 0, sizeof(zip_archive));
+    if (!mz_zip_reader_init_mem(&zip_archive, zip_data, zip_size, 0))
         return 0;
+    return stbup_zip_extract_reader(&zip_archive, out_dir, opts);
+}
+
+static int stbup_zip_extract_mem(const void *zip_data, size_t zip_size, const char *out_dir)
+{
+    return stbup_zip_extract_mem_ex(zip_data, zip_size, out_dir, NULL);
+}
 
-    /* Extract filename from path */
-    const char *filename = file_path;
-    const char *last_slash = strrchr(file_path, '/');
-    const char *last_backslash = strrchr(file_path, '\\');
-    if (last_slash || last_backslash)
+/* Directory tree being added to a ZIP archive */
+typedef struct
+{
+    mz_zip_archive *zip;
+    stbup_stat self;
+    int has_self;
+} stbup_zip_tree;
+
+/* Add one entry: directories as "name/", regular files streamed from disk */
+static int stbup_zip_add_entry(mz_zip_archive *zip, const char *path, const char *name,
+                               const stbup_stat *st)
+{
+    if (stbup_stat_is_dir(st))
     {
-        const char *last_sep = (last_slash > last_backslash) ? last_slash : last_backslash;
-        filename = last_sep + 1;
-    }
+        char member[STBUP_PATH_MAX + 1];
+        size_t len = strlen(name);
+        if (len >= STBUP_PATH_MAX)
+            return 0;
+        memcpy(member, name, len);
+        member[len] = '/';
+        member[len + 1] = 0;
+        return mz_zip_writer_add_mem(zip, member, "", 0, MZ_NO_COMPRESSION);
+    }
+    if (!stbup_stat_is_file(st))
+        return 1; /* ZIP has no portable way to store symlinks and special files */
+
+    /* read through the file in pieces, so its size is not limited by memory */
+    FILE *in = fopen(path, "rb");
+    uint64_t size = 0;
+    int ok = in && stbup_fsize64(in, &size) && stbup_fseek64(in, 0) &&
+             mz_zip_writer_add_cfile(zip, name, in, size, NULL, NULL, 0, MZ_DEFAULT_COMPRESSION,
+                                     NULL, 0, NULL, 0);
+    if (in)
+        fclose(in);
+    return ok;
+}
+
+static int stbup_zip_tree_visit(void *user, const char *path, const char *name, const stbup_stat *st)
+{
+    stbup_zip_tree *tree = (stbup_zip_tree *)user;
+    if (stbup_walk_is_self(&tree->self, tree->has_self, st))
+        return 1;
+    return stbup_zip_add_entry(tree->zip, path, name, st);
+}
+
+/* Create .zip archive from a file */
+static int stbup_zip_create_file(const char *archive_path, const char *file_path)
+{
+    stbup_stat st;
+    if (!stbup_stat_path(file_path, &st) || !stbup_stat_is_file(&st))
+        return 0;
 
     mz_zip_archive zip_archive;
     memset(&zip_archive, 0, sizeof(zip_archive));
 
     /* Initialize ZIP writer */
     if (!mz_zip_writer_init_file(&zip_archive, archive_path, 0))
-    {
-        free(file_data);
         return 0;
-    }
 
-    /* Add file to archive */
-    mz_bool success = mz_zip_writer_add_mem(&zip_archive, filename, file_data, file_size, MZ_DEFAULT_COMPRESSION);
+    /* Add file to archive, then finalize it */
+    int ok = stbup_zip_add_entry(&zip_archive, file_path, stbup_path_basename(file_path), &st) &&
+             mz_zip_writer_finalize_archive(&zip_archive);
+    return mz_zip_writer_end(&zip_archive) && ok;
+}
 
-    /* Finalize archive */
-    if (success)
-    {
-        success = mz_zip_writer_finalize_archive(&zip_archive);
-    }
+/*
+ * Create .zip archive from a directory tree, with entries named as for
+ * stbup_tar_create_dir. Symlinks and special files are left out.
+ */
+static int stbup_zip_create_dir_ex(const char *archive_path, const char *dir_path,
+                                   const stbup_create_options *opts)
+{
+    char path[STBUP_PATH_MAX];
+    char name[STBUP_PATH_MAX];
+    stbup_stat st;
+    if (!stbup_walk_root(dir_path, path, name) || !stbup_stat_path(path, &st) || !stbup_stat_is_dir(&st))
+        return 0;
+
+    mz_zip_archive zip_archive;
+    memset(&zip_archive, 0, sizeof(zip_archive));
+    if (!mz_zip_writer_init_file(&zip_archive, archive_path, 0))
+        return 0;
 
-    mz_zip_writer_end(&zip_archive);
-    free(file_data);
+    stbup_zip_tree tree;
+    tree.zip = &zip_archive;
+    tree.has_self = stbup_stat_path(archive_path, &tree.self);
+    int ok = (name[0] == 0 || stbup_zip_add_entry(&zip_archive, path, name, &st)) &&
+             stbup_walk(path, name, stbup_zip_tree_visit, &tree, opts ? opts->num_threads : 0,
+                        opts && opts->reproducible) &&
+             mz_zip_writer_finalize_archive(&zip_archive);
+    return mz_zip_writer_end(&zip_archive) && ok;
+}
 
-    return success ? 1 : 0;
+static int stbup_zip_create_dir(const char *archive_path, const char *dir_path)
+{
+    return stbup_zip_create_dir_ex(archive_path, dir_path, NULL);
 }
 #else
 /* Stub functions when miniz is not available */
+static int stbup_targz_extract_ex(const char *archive_path, const char *out_dir,
+                                  const stbup_extract_options *opts)
+{
+    (void)archive_path;
+    (void)out_dir;
+    (void)opts;
+    return 0;
+}
+
 static int stbup_targz_extract(const char *archive_path, const char *out_dir)
 {
     (void)archive_path;
@@ -2813,6 +8492,24 @@ static int stbup_targz_extract(const char *archive_path, const char *out_dir)
     return 0;
 }
 
+static int stbup_targz_extract_mem_ex(const void *gz_data, size_t gz_size, const char *out_dir,
+                                      const stbup_extract_options *opts)
+{
+    (void)gz_data;
+    (void)gz_size;
+    (void)out_dir;
+    (void)opts;
+    return 0;
+}
+
+static int stbup_targz_extract_mem(const void *gz_data, size_t gz_size, const char *out_dir)
+{
+    (void)gz_data;
+    (void)gz_size;
+    (void)out_dir;
+    return 0;
+}
+
 static int stbup_targz_create_file(const char *archive_path, const char *file_path)
 {
     (void)archive_path;
@@ -2820,6 +8517,39 @@ static int stbup_targz_create_file(const char *archive_path, const char *file_pa
     return 0;
 }
 
+static int stbup_targz_create_file_ex(const char *archive_path, const char *file_path,
+                                      const stbup_create_options *opts)
+{
+    (void)archive_path;
+    (void)file_path;
+    (void)opts;
+    return 0;
+}
+static int stbup_targz_create_dir(const char *archive_path, const char *dir_path)
+{
+    (void)archive_path;
+    (void)dir_path;
+    return 0;
+}
+
+static int stbup_targz_create_dir_ex(const char *archive_path, const char *dir_path,
+                                     const stbup_create_options *opts)
+{
+    (void)archive_path;
+    (void)dir_path;
+    (void)opts;
+    return 0;
+}
+
+static int stbup_zip_extract_ex(const char *archive_path, const char *out_dir,
+                                const stbup_extract_options *opts)
+{
+    (void)archive_path;
+    (void)out_dir;
+    (void)opts;
+    return 0;
+}
+
 static int stbup_zip_extract(const char *archive_path, const char *out_dir)
 {
     (void)archive_path;
@@ -2827,12 +8557,45 @@ static int stbup_zip_extract(const char *archive_path, const char *out_dir)
     return 0;
 }
 
+static int stbup_zip_extract_mem_ex(const void *zip_data, size_t zip_size, const char *out_dir,
+                                    const stbup_extract_options *opts)
+{
+    (void)zip_data;
+    (void)zip_size;
+    (void)out_dir;
+    (void)opts;
+    return 0;
+}
+
+static int stbup_zip_extract_mem(const void *zip_data, size_t zip_size, const char *out_dir)
+{
+    (void)zip_data;
+    (void)zip_size;
+    (void)out_dir;
+    return 0;
+}
+
 static int stbup_zip_create_file(const char *archive_path, const char *file_path)
 {
     (void)archive_path;
     (void)file_path;
     return 0;
 }
+static int stbup_zip_create_dir(const char *archive_path, const char *dir_path)
+{
+    (void)archive_path;
+    (void)dir_path;
+    return 0;
+}
+
+static int stbup_zip_create_dir_ex(const char *archive_path, const char *dir_path,
+                                   const stbup_create_options *opts)
+{
+    (void)archive_path;
+    (void)dir_path;
+    (void)opts;
+    return 0;
+}
 #endif
 
 #endif /* STB_UNPACK_H */
@@ -0,0 +1,4 @@
+// Compiles the implementation as C++; nob builds this to an object file only,
+// so C-only constructs in stb_unpack.h are caught before they ship.
+#define STB_UNPACK_IMPLEMENTATION
+#include "../../stb_unpack.h"
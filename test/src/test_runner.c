@@ -690,6 +690,14 @@ static int test_security(void) {
     return run_test_exe(exe_path("build/test_security"), "Security Tests", 0, args);
 }
 
+/**
+ * Feature test runner - runs unit tests for the extraction and creation features
+ */
+static int test_features(void) {
+    char *args[] = {};
+    return run_test_exe(exe_path("build/test_features"), "Feature Tests", 0, args);
+}
+
 static const TestCase tests[] = {
     {"TAR Extraction Test", test_tar_extract, false},
     {"TAR Creation Test", test_tar_create, false},
@@ -701,6 +709,7 @@ static const TestCase tests[] = {
     {".zip Compatibility Test", test_zip_compat, true},
     {".zip Comprehensive Test", test_zip_comprehensive, true},
     {"Security Tests", test_security, true},
+    {"Feature Tests", test_features, true},
 };
 
 /**